@@ -125,6 +125,33 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
   block->read_cnt++;
 }
 
+/** Reads the CNT sectors of BLOCK starting at SECTOR into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes, in as
+   few device requests as the driver allows.  Synchronizes like
+   block_read(). */
+void
+block_read_multi (struct block *block, block_sector_t sector, size_t cnt,
+                  void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  if (block->ops->read_multi != NULL)
+    block->ops->read_multi (block->aux, sector, cnt, buffer);
+  else
+    {
+      size_t i;
+
+      for (i = 0; i < cnt; i++)
+        block->ops->read (block->aux, sector + i,
+                          buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  block->read_cnt += cnt;
+}
+
 /** Write sector SECTOR to BLOCK from BUFFER, which must contain
    BLOCK_SECTOR_SIZE bytes.  Returns after the block device has
    acknowledged receiving the data.
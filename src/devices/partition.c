@@ -317,8 +317,19 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/** Reads the CNT sectors starting at SECTOR from partition P into
+   BUFFER, as one request to the underlying block device. */
+static void
+partition_read_multi (void *p_, block_sector_t sector, size_t cnt,
+                      void *buffer)
+{
+  struct partition *p = p_;
+  block_read_multi (p->block, p->start + sector, cnt, buffer);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_multi
   };
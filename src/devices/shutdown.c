@@ -11,8 +11,15 @@
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "filesys/cache.h"
+#include "filesys/journal.h"
 #include "filesys/filesys.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/ksm.h"
+#include "vm/swap.h"
+#endif
 
 /** Keyboard control register port. */
 #define CONTROL_REG 0x64
@@ -132,10 +139,17 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
+  journal_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  vm_frame_print_stats ();
+  ksm_print_stats ();
+  swap_print_stats ();
+#endif
 }
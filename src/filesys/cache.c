@@ -0,0 +1,402 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/** A cached sector.
+
+   SECTOR and ACCESSED are protected by cache_lock; everything
+   else, and the sector data, by the entry's own lock.  An entry
+   is only given a new sector while its lock is held, so whoever
+   holds the lock of an entry for sector S sees S's data. */
+struct cache_entry
+  {
+    block_sector_t sector;              /**< Cached sector, if in use. */
+    bool in_use;                        /**< Holds a sector? */
+    bool accessed;                      /**< Used since the clock passed? */
+    bool dirty;                         /**< Differs from the disk? */
+    bool readahead;                     /**< Read ahead, not used yet? */
+    bool pinned;                        /**< Uncommitted journal write? */
+    struct lock lock;                   /**< Protects data and dirty. */
+    uint8_t *data;                      /**< BLOCK_SECTOR_SIZE bytes. */
+  };
+
+static struct cache_entry cache[CACHE_SECTORS];
+
+/** Protects the sector-to-entry mapping and the clock hand. */
+static struct lock cache_lock;
+static size_t clock_hand;
+
+/** Statistics. */
+static unsigned long long hit_cnt;      /**< Lookups found in the cache. */
+static unsigned long long miss_cnt;     /**< Lookups read from disk. */
+static unsigned long long write_cnt;    /**< Dirty sectors written back. */
+static unsigned long long ra_cnt;       /**< Sectors read ahead. */
+static unsigned long long ra_hit_cnt;   /**< ...used afterwards. */
+static unsigned long long ra_waste_cnt; /**< ...evicted unused. */
+
+/** Read-ahead requests, a ring of sectors waiting for the
+   read-ahead thread. */
+static block_sector_t ra_queue[CACHE_RA_QUEUE];
+static size_t ra_head, ra_cnt_queued;
+static struct lock ra_lock;
+static struct condition ra_cond;
+
+static struct cache_entry *cache_get (block_sector_t, bool fill, bool *hit);
+static void note_use (struct cache_entry *);
+static struct cache_entry *choose_victim (void);
+static void write_back (struct cache_entry *);
+static thread_func flusher NO_RETURN;
+static thread_func reader NO_RETURN;
+
+/** Initializes the buffer cache and starts the flusher. */
+void
+cache_init (void) 
+{
+  size_t sectors_per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+  size_t i;
+
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_SECTORS; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      if (i % sectors_per_page == 0)
+        e->data = palloc_get_page (PAL_ASSERT);
+      else
+        e->data = cache[i - 1].data + BLOCK_SECTOR_SIZE;
+      lock_init (&e->lock);
+    }
+
+  lock_init (&ra_lock);
+  cond_init (&ra_cond);
+
+  thread_create ("flusher", PRI_DEFAULT, flusher, NULL);
+  thread_create ("readahead", PRI_DEFAULT, reader, NULL);
+}
+
+/** Reads sector SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer) 
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/** Reads SIZE bytes starting at byte OFS of sector SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size) 
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, NULL);
+  note_use (e);
+  memcpy (buffer, e->data + ofs, size);
+  lock_release (&e->lock);
+}
+
+/** Returns true if SECTOR is in the cache.  Nothing is read in.
+   A reader that finds SECTOR absent may read it from the disk
+   around the cache: every write that finished before the call is
+   either cached or already on disk. */
+bool
+cache_contains (block_sector_t sector) 
+{
+  bool found = false;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SECTORS; i++)
+    if (cache[i].in_use && cache[i].sector == sector)
+      {
+        found = true;
+        break;
+      }
+  lock_release (&cache_lock);
+  return found;
+}
+
+/** Writes BLOCK_SECTOR_SIZE bytes from BUFFER to sector SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer) 
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/** Writes SIZE bytes from BUFFER at byte OFS of sector SECTOR.
+   A write of the whole sector does not read it first. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, size_t ofs,
+                size_t size) 
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, NULL);
+  note_use (e);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  lock_release (&e->lock);
+}
+
+/** Writes SIZE bytes from BUFFER at byte OFS of sector SECTOR,
+   like cache_write_at(), and pins the sector: it is neither
+   written back nor evicted until cache_unpin().  This is how the
+   journal keeps uncommitted metadata off the disk.  Returns true
+   if the sector was not already pinned. */
+bool
+cache_write_pinned (block_sector_t sector, const void *buffer, size_t ofs,
+                    size_t size) 
+{
+  struct cache_entry *e;
+  bool was_pinned;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, NULL);
+  note_use (e);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  was_pinned = e->pinned;
+  e->pinned = true;
+  lock_release (&e->lock);
+  return !was_pinned;
+}
+
+/** Unpins SECTOR, pinned by cache_write_pinned(), leaving it dirty
+   to be written back in the usual way. */
+void
+cache_unpin (block_sector_t sector) 
+{
+  struct cache_entry *e = cache_get (sector, true, NULL);
+
+  ASSERT (e->pinned);
+  e->pinned = false;
+  lock_release (&e->lock);
+}
+
+/** Writes every dirty sector back to disk, except pinned ones. */
+void
+cache_flush (void) 
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SECTORS; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_acquire (&e->lock);
+      write_back (e);
+      lock_release (&e->lock);
+    }
+}
+
+/** Queues SECTOR to be read into the cache in the background.
+   The request is dropped if the queue is full: read-ahead is only
+   a hint. */
+void
+cache_readahead (block_sector_t sector) 
+{
+  lock_acquire (&ra_lock);
+  if (ra_cnt_queued < CACHE_RA_QUEUE)
+    {
+      ra_queue[(ra_head + ra_cnt_queued++) % CACHE_RA_QUEUE] = sector;
+      cond_signal (&ra_cond, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/** Prints buffer cache statistics. */
+void
+cache_print_stats (void) 
+{
+  printf ("Buffer cache: %llu hits, %llu misses, %llu write-backs\n",
+          hit_cnt, miss_cnt, write_cnt);
+  printf ("Read-ahead: %llu sectors, %llu hits, %llu wasted\n",
+          ra_cnt, ra_hit_cnt, ra_waste_cnt);
+}
+
+/** Counts a use of E, which is locked, by a reader or writer. */
+static void
+note_use (struct cache_entry *e) 
+{
+  if (e->readahead)
+    {
+      e->readahead = false;
+      ra_hit_cnt++;
+    }
+}
+
+/** Returns the entry for SECTOR with its lock held, bringing the
+   sector in if it is not cached.  If FILL is false the caller is
+   about to overwrite the whole sector, so it is not read.  If HIT
+   is nonnull, stores in it whether SECTOR was cached already. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool fill, bool *hit) 
+{
+  for (;;)
+    {
+      struct cache_entry *e = NULL;
+      size_t i;
+
+      lock_acquire (&cache_lock);
+      for (i = 0; i < CACHE_SECTORS; i++)
+        if (cache[i].in_use && cache[i].sector == sector)
+          {
+            e = &cache[i];
+            break;
+          }
+
+      if (e != NULL)
+        {
+          /* Hit.  The entry may be handed to another sector while
+             we wait for its lock, hence the check. */
+          e->accessed = true;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          if (e->in_use && e->sector == sector)
+            {
+              hit_cnt++;
+              if (hit != NULL)
+                *hit = true;
+              return e;
+            }
+          lock_release (&e->lock);
+          continue;
+        }
+
+      /* Miss: the victim comes back locked.  If every entry is
+         pinned or busy, wait for a commit to unpin some. */
+      e = choose_victim ();
+      if (e == NULL)
+        {
+          lock_release (&cache_lock);
+          timer_sleep (1);
+          continue;
+        }
+      if (e->dirty)
+        {
+          /* Write the victim back while it still maps its old
+             sector, so that nobody reads that sector from disk in
+             the meantime, then start over: SECTOR may have been
+             brought in by someone else. */
+          lock_release (&cache_lock);
+          write_back (e);
+          lock_release (&e->lock);
+          continue;
+        }
+
+      e->sector = sector;
+      e->in_use = true;
+      e->accessed = true;
+      e->readahead = false;
+      lock_release (&cache_lock);
+
+      miss_cnt++;
+      if (fill)
+        block_read (fs_device, sector, e->data);
+      if (hit != NULL)
+        *hit = false;
+      return e;
+    }
+}
+
+/** Picks an entry to replace by the clock algorithm, skipping
+   entries in use by others, and returns it locked.  Returns a
+   null pointer if two turns of the clock, enough to clear every
+   accessed bit, find none.  Must be called with cache_lock
+   held. */
+static struct cache_entry *
+choose_victim (void) 
+{
+  size_t probes;
+
+  for (probes = 0; probes < 2 * CACHE_SECTORS; probes++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+
+      clock_hand = (clock_hand + 1) % CACHE_SECTORS;
+      if (!lock_try_acquire (&e->lock))
+        continue;
+      if (e->pinned)
+        {
+          lock_release (&e->lock);
+          continue;
+        }
+      if (!e->in_use || !e->accessed)
+        {
+          if (e->readahead)
+            ra_waste_cnt++;
+          return e;
+        }
+      e->accessed = false;
+      lock_release (&e->lock);
+    }
+  return NULL;
+}
+
+/** Writes E to disk if it is dirty and not pinned.  E's lock must
+   be held. */
+static void
+write_back (struct cache_entry *e) 
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (e->in_use && e->dirty && !e->pinned)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      write_cnt++;
+    }
+}
+
+/** Writes dirty sectors back every CACHE_FLUSH_TICKS, so that a
+   crash loses at most that much work. */
+static void
+flusher (void *aux UNUSED) 
+{
+  for (;;)
+    {
+      timer_sleep (CACHE_FLUSH_TICKS);
+      cache_flush ();
+    }
+}
+
+/** Serves read-ahead requests, one sector at a time, so that the
+   reads overlap with the requesters' work. */
+static void
+reader (void *aux UNUSED) 
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+      block_sector_t sector;
+      bool hit;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt_queued == 0)
+        cond_wait (&ra_cond, &ra_lock);
+      sector = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % CACHE_RA_QUEUE;
+      ra_cnt_queued--;
+      lock_release (&ra_lock);
+
+      e = cache_get (sector, true, &hit);
+      if (!hit)
+        {
+          e->readahead = true;
+          ra_cnt++;
+        }
+      lock_release (&e->lock);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/** Buffer cache.
+
+   Sectors of the file system device are read and written through
+   a cache of CACHE_SECTORS sectors, replaced by the clock
+   algorithm.  Writes only mark a cached sector dirty; it reaches
+   the disk when it is evicted, when cache_flush() runs, or when
+   the flusher thread wakes up, every CACHE_FLUSH_TICKS, which
+   bounds how much is lost if the machine stops.
+
+   Sectors a reader is expected to want soon can be queued with
+   cache_readahead(); a background thread reads them in while the
+   reader works on earlier data.  Read-ahead sectors that get used
+   count as hits, those evicted unused as waste.
+
+   The journal pins the sectors of uncommitted transactions with
+   cache_write_pinned(); pinned sectors stay in the cache and off
+   the disk until cache_unpin(). */
+
+#define CACHE_SECTORS 64                /**< Sectors in the cache. */
+#define CACHE_FLUSH_TICKS (5 * TIMER_FREQ) /**< Flusher period. */
+#define CACHE_RA_QUEUE 64               /**< Queued read-ahead sectors. */
+
+void cache_init (void);
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, size_t ofs, size_t size);
+bool cache_contains (block_sector_t);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+bool cache_write_pinned (block_sector_t, const void *, size_t ofs,
+                         size_t size);
+void cache_unpin (block_sector_t);
+void cache_flush (void);
+void cache_readahead (block_sector_t);
+void cache_print_stats (void);
+
+#endif /**< filesys/cache.h */
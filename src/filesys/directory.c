@@ -1,6 +1,9 @@
 #include "filesys/directory.h"
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
@@ -11,6 +14,7 @@ struct dir
   {
     struct inode *inode;                /**< Backing store. */
     off_t pos;                          /**< Current position. */
+    bool hashed;                        /**< Hashed, or old flat format? */
   };
 
 /** A single directory entry. */
@@ -21,12 +25,118 @@ struct dir_entry
     bool in_use;                        /**< In use or free? */
   };
 
+/** Directory layout.
+
+   A directory is a sequence of BLOCK_SECTOR_SIZE blocks.  Block 0
+   is a header holding an extendible hash table: a name whose hash
+   ends in the DEPTH low bits I is in the bucket at block TABLE[I].
+   A full bucket is split in two, doubling the table first if
+   needed, so lookups, inserts and removes each touch the header
+   and one bucket.  Past DIR_MAX_DEPTH, full buckets instead grow
+   chains of overflow blocks.
+
+   Directories written in the old format, a flat array of
+   entries, are recognized by the missing magic number and are
+   still searched linearly. */
+#define DIR_MAGIC 0x48524944            /**< "DIRH". */
+#define DIR_MAX_DEPTH 7                 /**< Maximum table depth. */
+#define DIR_TABLE_SIZE (1 << DIR_MAX_DEPTH)
+#define DIR_BUCKET_ENTRIES 25           /**< Entries per bucket block. */
+#define DIR_MAX_BLOCKS UINT16_MAX       /**< Blocks a table can address. */
+
+/** Directory header, in block 0. */
+struct dir_header
+  {
+    uint32_t magic;                     /**< DIR_MAGIC. */
+    uint32_t depth;                     /**< Hash bits used by TABLE. */
+    uint16_t table[DIR_TABLE_SIZE];     /**< Bucket block for each hash. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8 - 2 * DIR_TABLE_SIZE];
+  };
+
+/** Bucket or overflow block. */
+struct dir_bucket
+  {
+    uint16_t depth;                     /**< Hash bits shared by entries. */
+    uint16_t entry_cnt;                 /**< Entries in use. */
+    uint32_t next;                      /**< Overflow block, or 0. */
+    struct dir_entry entries[DIR_BUCKET_ENTRIES];
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8
+                   - DIR_BUCKET_ENTRIES * sizeof (struct dir_entry)];
+  };
+
+/** Byte offset of entry IDX in directory block BLOCK. */
+static inline off_t
+entry_ofs (uint32_t block, size_t idx) 
+{
+  return block * BLOCK_SECTOR_SIZE + offsetof (struct dir_bucket, entries)
+         + idx * sizeof (struct dir_entry);
+}
+
+/** Reads directory block BLOCK of INODE into BUF. */
+static bool
+read_block (struct inode *inode, uint32_t block, void *buf) 
+{
+  return inode_read_at (inode, buf, BLOCK_SECTOR_SIZE,
+                        block * BLOCK_SECTOR_SIZE) == BLOCK_SECTOR_SIZE;
+}
+
+/** Writes BUF to directory block BLOCK of INODE, growing INODE if
+   BLOCK is past its end. */
+static bool
+write_block (struct inode *inode, uint32_t block, const void *buf) 
+{
+  return inode_write_at (inode, buf, BLOCK_SECTOR_SIZE,
+                         block * BLOCK_SECTOR_SIZE) == BLOCK_SECTOR_SIZE;
+}
+
 /** Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header *h = NULL;
+  struct dir_bucket *b = NULL;
+  struct inode *inode;
+  uint32_t depth = 0;
+  uint32_t i;
+  bool success = false;
+
+  ASSERT (sizeof (struct dir_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  /* Start with enough buckets for ENTRY_CNT evenly hashed names. */
+  while (depth < DIR_MAX_DEPTH
+         && ((size_t) DIR_BUCKET_ENTRIES << depth) < entry_cnt)
+    depth++;
+
+  /* Allocate every block up front, so that only inode_create()
+     can run out of disk space. */
+  if (!inode_create (sector, ((1u << depth) + 1) * BLOCK_SECTOR_SIZE))
+    return false;
+  inode = inode_open (sector);
+  if (inode != NULL)
+    inode_set_journaled (inode);
+  h = calloc (1, sizeof *h);
+  b = calloc (1, sizeof *b);
+  if (inode == NULL || h == NULL || b == NULL)
+    goto done;
+
+  h->magic = DIR_MAGIC;
+  h->depth = depth;
+  b->depth = depth;
+  for (i = 0; i < (1u << depth); i++)
+    {
+      h->table[i] = i + 1;
+      if (!write_block (inode, i + 1, b))
+        goto done;
+    }
+  success = write_block (inode, 0, h);
+
+ done:
+  inode_close (inode);
+  free (h);
+  free (b);
+  return success;
 }
 
 /** Opens and returns the directory for the given INODE, of which
@@ -37,8 +147,13 @@ dir_open (struct inode *inode)
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
     {
+      uint32_t magic;
+
+      inode_set_journaled (inode);
       dir->inode = inode;
-      dir->pos = 0;
+      dir->hashed = (inode_read_at (inode, &magic, sizeof magic, 0)
+                     == sizeof magic && magic == DIR_MAGIC);
+      dir->pos = dir->hashed ? entry_ofs (1, 0) : 0;
       return dir;
     }
   else
@@ -83,20 +198,29 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/** Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+/** Returns the first block of the bucket in DIR for names with
+   the given HASH. */
+static uint32_t
+find_bucket (const struct dir *dir, unsigned hash) 
+{
+  uint32_t depth;
+  uint16_t block;
+
+  inode_read_at (dir->inode, &depth, sizeof depth,
+                 offsetof (struct dir_header, depth));
+  hash &= (1u << depth) - 1;
+  inode_read_at (dir->inode, &block, sizeof block,
+                 offsetof (struct dir_header, table) + hash * sizeof block);
+  return block;
+}
+
+/** Searches flat directory DIR like lookup(). */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+flat_lookup (const struct dir *dir, const char *name,
+             struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
   size_t ofs;
-  
-  ASSERT (dir != NULL);
-  ASSERT (name != NULL);
 
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
@@ -111,6 +235,49 @@ lookup (const struct dir *dir, const char *name,
   return false;
 }
 
+/** Searches DIR for a file with the given NAME.
+   If successful, returns true, sets *EP to the directory entry
+   if EP is non-null, and sets *OFSP to the byte offset of the
+   directory entry if OFSP is non-null.
+   otherwise, returns false and ignores EP and OFSP. */
+static bool
+lookup (const struct dir *dir, const char *name,
+        struct dir_entry *ep, off_t *ofsp) 
+{
+  struct dir_bucket *b;
+  uint32_t block;
+  bool found = false;
+  
+  ASSERT (dir != NULL);
+  ASSERT (name != NULL);
+
+  if (!dir->hashed)
+    return flat_lookup (dir, name, ep, ofsp);
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+  for (block = find_bucket (dir, hash_string (name));
+       block != 0 && !found && read_block (dir->inode, block, b);
+       block = b->next) 
+    {
+      size_t i;
+
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++) 
+        if (b->entries[i].in_use && !strcmp (name, b->entries[i].name)) 
+          {
+            if (ep != NULL)
+              *ep = b->entries[i];
+            if (ofsp != NULL)
+              *ofsp = entry_ofs (block, i);
+            found = true;
+            break;
+          }
+    }
+  free (b);
+  return found;
+}
+
 /** Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
@@ -124,14 +291,123 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_dir_lock (dir->inode);
   if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  inode_dir_unlock (dir->inode);
 
   return *inode != NULL;
 }
 
+/** Splits full bucket B, at BLOCK, of hashed directory DIR whose
+   header is H, moving half its entries to a new bucket in NB. */
+static bool
+split_bucket (struct dir *dir, struct dir_header *h,
+              uint32_t block, struct dir_bucket *b, struct dir_bucket *nb) 
+{
+  uint32_t new_block = inode_length (dir->inode) / BLOCK_SECTOR_SIZE;
+  uint32_t bit = 1u << b->depth;
+  size_t i;
+
+  if (new_block > DIR_MAX_BLOCKS)
+    return false;
+
+  memset (nb, 0, sizeof *nb);
+  nb->depth = ++b->depth;
+  for (i = 0; i < DIR_BUCKET_ENTRIES; i++) 
+    if (b->entries[i].in_use && (hash_string (b->entries[i].name) & bit)) 
+      {
+        nb->entries[nb->entry_cnt++] = b->entries[i];
+        b->entries[i].in_use = false;
+        b->entry_cnt--;
+      }
+  if (!write_block (dir->inode, new_block, nb)
+      || !write_block (dir->inode, block, b))
+    return false;
+
+  for (i = 0; i < (1u << h->depth); i++)
+    if (h->table[i] == block && (i & bit))
+      h->table[i] = new_block;
+  return write_block (dir->inode, 0, h);
+}
+
+/** Adds NAME to hashed directory DIR, like dir_add(). */
+static bool
+hashed_add (struct dir *dir, const char *name, block_sector_t inode_sector) 
+{
+  struct dir_header *h = malloc (sizeof *h);
+  struct dir_bucket *b = malloc (sizeof *b);
+  struct dir_bucket *nb = malloc (sizeof *nb);
+  unsigned hash = hash_string (name);
+  bool success = false;
+
+  if (h == NULL || b == NULL || nb == NULL
+      || !read_block (dir->inode, 0, h))
+    goto done;
+
+  for (;;) 
+    {
+      uint32_t block = h->table[hash & ((1u << h->depth) - 1)];
+      size_t i;
+
+      /* Find room in the bucket or its overflow chain. */
+      if (!read_block (dir->inode, block, b))
+        break;
+      while (b->entry_cnt == DIR_BUCKET_ENTRIES && b->next != 0) 
+        {
+          block = b->next;
+          if (!read_block (dir->inode, block, b))
+            goto done;
+        }
+
+      if (b->entry_cnt < DIR_BUCKET_ENTRIES) 
+        {
+          for (i = 0; b->entries[i].in_use; i++)
+            continue;
+          b->entries[i].in_use = true;
+          strlcpy (b->entries[i].name, name, sizeof b->entries[i].name);
+          b->entries[i].inode_sector = inode_sector;
+          b->entry_cnt++;
+          success = write_block (dir->inode, block, b);
+          break;
+        }
+      else if (b->depth < h->depth) 
+        {
+          if (!split_bucket (dir, h, block, b, nb))
+            break;
+        }
+      else if (h->depth < DIR_MAX_DEPTH) 
+        {
+          /* Double the table; the split happens next time round. */
+          for (i = 0; i < (1u << h->depth); i++)
+            h->table[i + (1u << h->depth)] = h->table[i];
+          h->depth++;
+          if (!write_block (dir->inode, 0, h))
+            break;
+        }
+      else 
+        {
+          /* The table is as big as it gets: chain a new block. */
+          uint32_t new_block = inode_length (dir->inode) / BLOCK_SECTOR_SIZE;
+
+          memset (nb, 0, sizeof *nb);
+          nb->depth = b->depth;
+          b->next = new_block;
+          if (!write_block (dir->inode, new_block, nb)
+              || !write_block (dir->inode, block, b))
+            break;
+        }
+    }
+
+ done:
+  free (h);
+  free (b);
+  free (nb);
+  return success;
+}
+
 /** Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
@@ -153,9 +429,16 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
     return false;
 
   /* Check that NAME is not in use. */
+  inode_dir_lock (dir->inode);
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
+  if (dir->hashed) 
+    {
+      success = hashed_add (dir, name, inode_sector);
+      goto done;
+    }
+
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
@@ -175,6 +458,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
  done:
+  inode_dir_unlock (dir->inode);
   return success;
 }
 
@@ -193,6 +477,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  inode_dir_lock (dir->inode);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -205,12 +490,25 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  if (dir->hashed) 
+    {
+      off_t cnt_ofs = ofs - ofs % BLOCK_SECTOR_SIZE
+                      + offsetof (struct dir_bucket, entry_cnt);
+      uint16_t cnt;
+
+      if (inode_read_at (dir->inode, &cnt, sizeof cnt, cnt_ofs) != sizeof cnt)
+        goto done;
+      cnt--;
+      if (inode_write_at (dir->inode, &cnt, sizeof cnt, cnt_ofs) != sizeof cnt)
+        goto done;
+    }
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  inode_dir_unlock (dir->inode);
   inode_close (inode);
   return success;
 }
@@ -222,15 +520,22 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  inode_dir_lock (dir->inode);
+  while (!found
+         && inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
+      if (dir->hashed
+          && dir->pos % BLOCK_SECTOR_SIZE == entry_ofs (0, DIR_BUCKET_ENTRIES))
+        dir->pos = entry_ofs (dir->pos / BLOCK_SECTOR_SIZE + 1, 0);
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
         } 
     }
-  return false;
+  inode_dir_unlock (dir->inode);
+  return found;
 }
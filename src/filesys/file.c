@@ -3,14 +3,27 @@
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/** Read-ahead window bounds, in sectors.  The window starts at
+   FILE_RA_MIN when a file is read sequentially and doubles with
+   each further sequential read, up to FILE_RA_MAX. */
+#define FILE_RA_MIN 2
+#define FILE_RA_MAX 32
+
 /** An open file. */
 struct file 
   {
     struct inode *inode;        /**< File's inode. */
     off_t pos;                  /**< Current position. */
     bool deny_write;            /**< Has file_deny_write() been called? */
+
+    /* Sequential read detection. */
+    off_t ra_next;              /**< Where a sequential read would start. */
+    off_t ra_end;               /**< End of what was read ahead. */
+    int ra_window;              /**< Sectors to read ahead, 0 if random. */
   };
 
+static void file_readahead (struct file *, off_t offset, off_t size);
+
 /** Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +36,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -69,6 +85,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_readahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,7 +98,23 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  file_readahead (file, file_ofs, bytes_read);
+  return bytes_read;
+}
+
+/** Reads from FILE into the CNT buffers of IOV in turn, starting
+   at the file's current position.
+   Returns the number of bytes actually read, which may be less
+   than the buffers hold if end of file is reached.
+   Advances FILE's position by the number of bytes read.  Large
+   reads bypass the buffer cache, so no read-ahead is started. */
+off_t
+file_readv (struct file *file, const struct iovec *iov, size_t cnt) 
+{
+  off_t bytes_read = inode_readv (file->inode, iov, cnt, file->pos);
+  file->pos += bytes_read;
+  return bytes_read;
 }
 
 /** Writes SIZE bytes from BUFFER into FILE,
@@ -99,6 +132,18 @@ file_write (struct file *file, const void *buffer, off_t size)
   return bytes_written;
 }
 
+/** Writes the CNT buffers of IOV in turn into FILE, starting at
+   the file's current position, growing it as needed.
+   Returns the number of bytes actually written.
+   Advances FILE's position by the number of bytes written. */
+off_t
+file_writev (struct file *file, const struct iovec *iov, size_t cnt) 
+{
+  off_t bytes_written = inode_writev (file->inode, iov, cnt, file->pos);
+  file->pos += bytes_written;
+  return bytes_written;
+}
+
 /** Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
@@ -166,3 +211,40 @@ file_tell (struct file *file)
   ASSERT (file != NULL);
   return file->pos;
 }
+
+/** Notes that SIZE bytes of FILE were just read at OFFSET.  If the
+   read continues the previous one, grows the read-ahead window and
+   has the sectors within the window past the read brought into the
+   buffer cache in the background; otherwise the access is random
+   and nothing is read ahead. */
+static void
+file_readahead (struct file *file, off_t offset, off_t size) 
+{
+  off_t end = offset + size;
+  off_t ra_start, ra_stop;
+
+  if (size == 0)
+    return;
+
+  if (offset != file->ra_next)
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+  else if (file->ra_window == 0)
+    file->ra_window = FILE_RA_MIN;
+  else if (file->ra_window < FILE_RA_MAX)
+    file->ra_window *= 2;
+  file->ra_next = end;
+  if (file->ra_window == 0)
+    return;
+
+  /* Only ask for what earlier reads have not asked for. */
+  ra_start = end > file->ra_end ? end : file->ra_end;
+  ra_stop = end + file->ra_window * BLOCK_SECTOR_SIZE;
+  if (ra_start < ra_stop)
+    {
+      inode_readahead (file->inode, ra_start, ra_stop - ra_start);
+      file->ra_end = ra_stop;
+    }
+}
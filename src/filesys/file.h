@@ -1,6 +1,8 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <iovec.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 
 struct inode;
@@ -14,8 +16,10 @@ struct inode *file_get_inode (struct file *);
 /** Reading and writing. */
 off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
+off_t file_readv (struct file *, const struct iovec *, size_t cnt);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+off_t file_writev (struct file *, const struct iovec *, size_t cnt);
 
 /** Preventing writes. */
 void file_deny_write (struct file *);
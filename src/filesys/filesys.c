@@ -2,15 +2,18 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 
 /** Partition that contains the file system. */
 struct block *fs_device;
 
 static void do_format (void);
+static bool do_create (const char *name, off_t initial_size);
 
 /** Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -21,12 +24,14 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
 
+  journal_open ();
   free_map_open ();
 }
 
@@ -36,6 +41,8 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  journal_done ();
+  cache_flush ();
 }
 
 /** Creates a file named NAME with the given INITIAL_SIZE.
@@ -44,16 +51,38 @@ filesys_done (void)
    or if internal memory allocation fails. */
 bool
 filesys_create (const char *name, off_t initial_size) 
+{
+  bool success = do_create (name, initial_size);
+
+  /* Sectors released by a recent remove only become free once the
+     journal checkpoints; if they were all that was missing, do so
+     and try again. */
+  if (!success && free_map_reclaim ())
+    success = do_create (name, initial_size);
+  return success;
+}
+
+/** Creates a file named NAME with the given INITIAL_SIZE, as
+   filesys_create() does, inside one journal handle. */
+static bool
+do_create (const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  struct dir *dir;
+  block_sector_t dir_sector;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_root ();
+  dir_sector = dir != NULL ? inode_get_inumber (dir_get_inode (dir)) : 0;
+  success = (dir != NULL
+             && free_map_allocate_near (dir_sector, 1, &inode_sector)
+             && inode_create (inode_sector, initial_size)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -83,9 +112,14 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_root ();
+  success = dir != NULL && dir_remove (dir, name);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
@@ -96,6 +130,7 @@ do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
+  journal_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
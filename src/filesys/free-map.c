@@ -1,13 +1,90 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <list.h>
+#include <random.h>
+#include <round.h>
+#include "devices/timer.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 
 static struct file *free_map_file;   /**< Free map file. */
 static struct bitmap *free_map;      /**< Free map, one bit per sector. */
 
+/** Free-extent index.
+
+   The bitmap is what goes to disk, but allocation works from an
+   index of the free runs, the maximal extents of free sectors,
+   kept in a treap ordered by start sector.  Each node also records
+   the longest run in its subtree, so finding the run that holds a
+   sector, the largest run, or the first run past a sector with
+   room for N sectors all take time logarithmic in the number of
+   runs. */
+struct free_run
+  {
+    block_sector_t start;            /**< First free sector. */
+    size_t length;                   /**< Number of free sectors. */
+    size_t max;                      /**< Longest run in this subtree. */
+    unsigned long prio;              /**< Treap heap priority. */
+    struct free_run *left;           /**< Runs before this one. */
+    struct free_run *right;          /**< Runs after this one. */
+  };
+
+static struct free_run *free_runs;   /**< Root of the free-run treap. */
+
+static void runs_build (void);
+static void take_sectors (block_sector_t, size_t);
+static void give_sectors (block_sector_t, size_t);
+static struct free_run *find_run (block_sector_t);
+static struct free_run *find_fit (struct free_run *, block_sector_t, size_t);
+
+/** Write-back.
+
+   Allocations and frees change the in-memory map and mark the free
+   map file sectors that hold their bits dirty, and only those
+   sectors are written, through the journal.  An allocation writes
+   the sectors holding its own bits at once, inside the caller's
+   journal handle, so they commit with the inode that uses the
+   sectors; an allocation of at most BITS_PER_SECTOR sectors
+   touches at most two, which keeps the handle within its
+   JOURNAL_HANDLE_SECTORS.
+
+   Freed sectors stay allocated, on disk and in memory, until the
+   journal has checkpointed the transaction that released them, so
+   the map never says a sector is free while a committed inode or
+   directory still uses it, and replaying the log can never
+   overwrite a sector once it has been reused.  free_map_flush(),
+   run every FREE_MAP_FLUSH_TICKS and at shutdown, checkpoints,
+   frees them and writes the dirty sectors.  An allocation that
+   fails while sectors are pending cannot wait that long, so it
+   notes the shortage, and its caller, once out of its handle, runs
+   free_map_reclaim() and tries again. */
+struct pending_free
+  {
+    struct list_elem elem;           /**< Element in PENDING_FREES. */
+    block_sector_t start;            /**< First sector. */
+    size_t cnt;                      /**< Number of sectors. */
+    unsigned seq;                    /**< Journal transaction of release. */
+  };
+
+static struct list pending_frees;    /**< Released, not yet free. */
+static struct bitmap *dirty;         /**< Free map file sectors to write. */
+static bool starved;                 /**< Allocation failed, frees pending. */
+static struct lock free_map_lock;    /**< Protects all of the above. */
+
+/** Bits of the free map held by one sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+static thread_func flusher NO_RETURN;
+static void apply_frees (void);
+static bool write_dirty (size_t max);
+static void write_sectors_of (block_sector_t, size_t);
+
 /** Initializes the free map. */
 void
 free_map_init (void) 
@@ -15,38 +92,200 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                       BLOCK_SECTOR_SIZE));
+  if (dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  list_init (&pending_frees);
+  lock_init (&free_map_lock);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, JOURNAL_SECTOR);
+  runs_build ();
 }
 
 /** Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/** Returns the start of a free run of CNT sectors as close to GOAL
+   as possible, or BITMAP_ERROR if there is none.  See
+   free_map_allocate_near() for the order of preference. */
+static block_sector_t
+find_near (block_sector_t goal, size_t cnt) 
+{
+  block_sector_t group = goal - goal % FREE_MAP_GROUP_SECTORS;
+  block_sector_t group_end = group + FREE_MAP_GROUP_SECTORS;
+  struct free_run *r;
+
+  r = find_run (goal);
+  if (r != NULL && r->start + r->length - goal >= cnt)
+    return goal;
+  else if ((r = find_fit (free_runs, goal, cnt)) != NULL
+           && r->start < group_end)
+    return r->start;
+  else if ((r = find_fit (free_runs, group, cnt)) != NULL
+           && r->start < group_end)
+    return r->start;
+  else if ((r = find_fit (free_runs, group_end, cnt)) != NULL
+           || (r = find_fit (free_runs, 0, cnt)) != NULL)
+    return r->start;
+  else
+    return BITMAP_ERROR;
+}
+
+/** Like free_map_allocate(), but places the sectors as close to
+   sector GOAL as it can: at GOAL itself if free, else in the first
+   free run after GOAL within GOAL's block group, else anywhere in
+   that group, else in the first run after the group, and only
+   then from the start of the disk.  Callers pass the sector just
+   past a file's last extent, or the inode of the parent
+   directory, so that related data stays together.  If nothing
+   fits, frees any released sectors that can be and tries once
+   more; if that fails too while others are still pending, the
+   caller should close its handle and call free_map_reclaim().
+   The caller must hold a journal handle. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector;
+  bool retry;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  sector = find_near (goal, cnt);
+  retry = sector == BITMAP_ERROR && !list_empty (&pending_frees);
+  if (retry)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      apply_frees ();
+      sector = find_near (goal, cnt);
+      if (sector == BITMAP_ERROR && !list_empty (&pending_frees))
+        starved = true;
     }
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+    {
+      take_sectors (sector, cnt);
+      write_sectors_of (sector, cnt);
+    }
+  lock_release (&free_map_lock);
+
+  if (sector == BITMAP_ERROR)
+    return false;
+  *sectorp = sector;
+  return true;
+}
+
+/** Allocates up to CNT consecutive sectors starting at SECTOR,
+   stopping at the first one in use, and returns how many were
+   allocated.  Lets a file extend its last extent in place.  The
+   caller must hold a journal handle. */
+size_t
+free_map_extend (block_sector_t sector, size_t cnt)
+{
+  struct free_run *r;
+  size_t n = 0;
+
+  lock_acquire (&free_map_lock);
+  r = find_run (sector);
+  if (r != NULL) 
+    {
+      n = r->start + r->length - sector;
+      if (n > cnt)
+        n = cnt;
+      if (n > 0)
+        {
+          take_sectors (sector, n);
+          write_sectors_of (sector, n);
+        }
+    }
+  lock_release (&free_map_lock);
+  return n;
 }
 
-/** Makes CNT sectors starting at SECTOR available for use. */
+/** Makes CNT sectors starting at SECTOR available for use, once
+   the journal has checkpointed the changes that released them. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  struct pending_free *p = malloc (sizeof *p);
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  if (p != NULL)
+    {
+      p->start = sector;
+      p->cnt = cnt;
+      p->seq = journal_seq ();
+      list_push_back (&pending_frees, &p->elem);
+    }
+  else
+    {
+      /* Out of memory: free them now, without the ordering. */
+      give_sectors (sector, cnt);
+    }
+  lock_release (&free_map_lock);
+}
+
+/** If an allocation has failed since the last call for want of
+   sectors still waiting to be freed, checkpoints the journal,
+   frees them, and returns true, so that the caller can try again.
+   Otherwise returns false.  The caller must not hold a journal
+   handle. */
+bool
+free_map_reclaim (void) 
+{
+  bool reclaim;
+
+  lock_acquire (&free_map_lock);
+  reclaim = starved;
+  starved = false;
+  lock_release (&free_map_lock);
+  if (!reclaim)
+    return false;
+
+  journal_checkpoint ();
+  lock_acquire (&free_map_lock);
+  apply_frees ();
+  lock_release (&free_map_lock);
+  return true;
+}
+
+/** Checkpoints the journal if sectors are waiting to be freed,
+   frees them, and writes the dirty sectors of the free map.  The
+   caller must not hold a journal handle. */
+void
+free_map_flush (void) 
+{
+  bool pending, more;
+
+  lock_acquire (&free_map_lock);
+  pending = !list_empty (&pending_frees);
+  lock_release (&free_map_lock);
+  if (pending)
+    journal_checkpoint ();
+
+  lock_acquire (&free_map_lock);
+  apply_frees ();
+  lock_release (&free_map_lock);
+
+  /* A handle may only change so many sectors. */
+  do
+    {
+      journal_begin ();
+      lock_acquire (&free_map_lock);
+      more = write_dirty (JOURNAL_HANDLE_SECTORS);
+      lock_release (&free_map_lock);
+      journal_end ();
+    }
+  while (more);
 }
 
 /** Opens the free map file and reads it from disk. */
@@ -58,13 +297,20 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  inode_set_journaled (file_get_inode (free_map_file));
+  runs_build ();
+  thread_create ("fmflush", PRI_DEFAULT, flusher, NULL);
 }
 
 /** Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /** Creates a new free map file on disk and writes the free map to
@@ -82,4 +328,310 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  inode_set_journaled (file_get_inode (free_map_file));
+  bitmap_set_all (dirty, false);
+}
+
+/** Flushes the free map every FREE_MAP_FLUSH_TICKS. */
+static void
+flusher (void *aux UNUSED) 
+{
+  for (;;)
+    {
+      timer_sleep (FREE_MAP_FLUSH_TICKS);
+      free_map_flush ();
+    }
+}
+
+/** Frees the sectors of each pending_free whose release the
+   journal has checkpointed.  Must be called with free_map_lock
+   held. */
+static void
+apply_frees (void) 
+{
+  unsigned done = journal_checkpointed_seq ();
+  struct list_elem *e;
+
+  for (e = list_begin (&pending_frees); e != list_end (&pending_frees); )
+    {
+      struct pending_free *p = list_entry (e, struct pending_free, elem);
+
+      e = list_next (e);
+      if (p->seq <= done)
+        {
+          list_remove (&p->elem);
+          give_sectors (p->start, p->cnt);
+          free (p);
+        }
+    }
+}
+
+/** Writes up to MAX dirty sectors of the free map to its file.
+   Returns true if dirty sectors remain.  Must be called with
+   free_map_lock held, inside a journal handle. */
+static bool
+write_dirty (size_t max) 
+{
+  size_t i;
+
+  if (free_map_file == NULL)
+    return false;
+  while (max-- > 0 && (i = bitmap_scan (dirty, 0, 1, true)) != BITMAP_ERROR)
+    {
+      size_t start = i * BITS_PER_SECTOR;
+      size_t cnt = bitmap_size (free_map) - start;
+
+      if (cnt > BITS_PER_SECTOR)
+        cnt = BITS_PER_SECTOR;
+      if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+        return false;
+      bitmap_reset (dirty, i);
+    }
+  return bitmap_contains (dirty, 0, bitmap_size (dirty), true);
+}
+
+/** Writes those of the free map file sectors holding the CNT bits
+   at START that are dirty.  Must be called with free_map_lock
+   held, inside a journal handle. */
+static void
+write_sectors_of (block_sector_t start, size_t cnt) 
+{
+  size_t first = start / BITS_PER_SECTOR;
+  size_t last = (start + cnt - 1) / BITS_PER_SECTOR;
+  size_t i;
+
+  if (free_map_file == NULL)
+    return;
+  for (i = first; i <= last; i++)
+    if (bitmap_test (dirty, i))
+      {
+        size_t bit = i * BITS_PER_SECTOR;
+        size_t bits = bitmap_size (free_map) - bit;
+
+        if (bits > BITS_PER_SECTOR)
+          bits = BITS_PER_SECTOR;
+        if (!bitmap_write_range (free_map, free_map_file, bit, bits))
+          return;
+        bitmap_reset (dirty, i);
+      }
+}
+
+/** Marks the free map file sectors holding the CNT bits at START
+   dirty. */
+static void
+mark_dirty (block_sector_t start, size_t cnt) 
+{
+  size_t first = start / BITS_PER_SECTOR;
+  size_t last = (start + cnt - 1) / BITS_PER_SECTOR;
+
+  bitmap_set_multiple (dirty, first, last - first + 1, true);
+}
+
+/** Returns the longest run in subtree T. */
+static size_t
+run_max (const struct free_run *t) 
+{
+  return t != NULL ? t->max : 0;
+}
+
+/** Recomputes T's longest run from its children. */
+static void
+run_update (struct free_run *t) 
+{
+  t->max = t->length;
+  if (run_max (t->left) > t->max)
+    t->max = run_max (t->left);
+  if (run_max (t->right) > t->max)
+    t->max = run_max (t->right);
+}
+
+/** Joins treaps A and B, all of whose runs come before B's. */
+static struct free_run *
+runs_merge (struct free_run *a, struct free_run *b) 
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (a->prio > b->prio) 
+    {
+      a->right = runs_merge (a->right, b);
+      run_update (a);
+      return a;
+    }
+  else 
+    {
+      b->left = runs_merge (a, b->left);
+      run_update (b);
+      return b;
+    }
+}
+
+/** Splits treap T into the runs starting before SECTOR, stored in
+   *LO, and the rest, stored in *HI. */
+static void
+runs_split (struct free_run *t, block_sector_t sector,
+            struct free_run **lo, struct free_run **hi) 
+{
+  if (t == NULL) 
+    {
+      *lo = *hi = NULL;
+      return;
+    }
+  if (t->start < sector) 
+    {
+      runs_split (t->right, sector, &t->right, hi);
+      *lo = t;
+    }
+  else 
+    {
+      runs_split (t->left, sector, lo, &t->left);
+      *hi = t;
+    }
+  run_update (t);
+}
+
+/** Adds the free run of CNT sectors at START to the index. */
+static void
+add_run (block_sector_t start, size_t cnt) 
+{
+  struct free_run *r = malloc (sizeof *r);
+  struct free_run *lo, *hi;
+
+  if (r == NULL)
+    PANIC ("out of memory for free map index");
+  r->start = start;
+  r->length = r->max = cnt;
+  r->prio = random_ulong ();
+  r->left = r->right = NULL;
+  runs_split (free_runs, start, &lo, &hi);
+  free_runs = runs_merge (runs_merge (lo, r), hi);
+}
+
+/** Removes the free run starting at START from the index. */
+static void
+remove_run (block_sector_t start) 
+{
+  struct free_run *lo, *mid, *hi;
+
+  runs_split (free_runs, start, &lo, &hi);
+  runs_split (hi, start + 1, &mid, &hi);
+  ASSERT (mid != NULL && mid->left == NULL && mid->right == NULL);
+  free (mid);
+  free_runs = runs_merge (lo, hi);
+}
+
+/** Frees every node of treap T. */
+static void
+runs_destroy (struct free_run *t) 
+{
+  if (t != NULL) 
+    {
+      runs_destroy (t->left);
+      runs_destroy (t->right);
+      free (t);
+    }
+}
+
+/** Rebuilds the index from the bitmap. */
+static void
+runs_build (void) 
+{
+  size_t size = bitmap_size (free_map);
+  size_t start = 0;
+
+  runs_destroy (free_runs);
+  free_runs = NULL;
+  while ((start = bitmap_scan (free_map, start, 1, false)) != BITMAP_ERROR) 
+    {
+      size_t end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = size;
+      add_run (start, end - start);
+      start = end;
+    }
+}
+
+/** Returns the free run that holds SECTOR, or a null pointer if
+   SECTOR is in use. */
+static struct free_run *
+find_run (block_sector_t sector) 
+{
+  struct free_run *t, *best = NULL;
+
+  for (t = free_runs; t != NULL; )
+    if (t->start <= sector) 
+      {
+        best = t;
+        t = t->right;
+      }
+    else
+      t = t->left;
+  return best != NULL && sector < best->start + best->length ? best : NULL;
+}
+
+/** Returns the first run in treap T that starts at or after
+   SECTOR and holds at least CNT sectors, or a null pointer if
+   there is none. */
+static struct free_run *
+find_fit (struct free_run *t, block_sector_t sector, size_t cnt) 
+{
+  struct free_run *r;
+
+  if (t == NULL || t->max < cnt)
+    return NULL;
+  if (t->start < sector)
+    return find_fit (t->right, sector, cnt);
+  r = find_fit (t->left, sector, cnt);
+  if (r != NULL)
+    return r;
+  if (t->length >= cnt)
+    return t;
+  return find_fit (t->right, sector, cnt);
+}
+
+/** Marks the CNT sectors at START, which lie in one free run, as
+   used. */
+static void
+take_sectors (block_sector_t start, size_t cnt) 
+{
+  struct free_run *r = find_run (start);
+  block_sector_t run_start, run_end;
+
+  ASSERT (r != NULL && start + cnt <= r->start + r->length);
+  run_start = r->start;
+  run_end = r->start + r->length;
+  remove_run (run_start);
+  if (start > run_start)
+    add_run (run_start, start - run_start);
+  if (start + cnt < run_end)
+    add_run (start + cnt, run_end - (start + cnt));
+  bitmap_set_multiple (free_map, start, cnt, true);
+  mark_dirty (start, cnt);
+}
+
+/** Marks the CNT sectors at START as free, merging them with the
+   free runs on either side. */
+static void
+give_sectors (block_sector_t start, size_t cnt) 
+{
+  struct free_run *before = start > 0 ? find_run (start - 1) : NULL;
+  struct free_run *after = find_run (start + cnt);
+  block_sector_t run_start = start;
+  size_t run_len = cnt;
+
+  if (before != NULL) 
+    {
+      run_start = before->start;
+      run_len += before->length;
+      remove_run (before->start);
+    }
+  if (after != NULL) 
+    {
+      run_len += after->length;
+      remove_run (after->start);
+    }
+  add_run (run_start, run_len);
+  bitmap_set_multiple (free_map, start, cnt, false);
+  mark_dirty (start, cnt);
 }
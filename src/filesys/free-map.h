@@ -5,6 +5,12 @@
 #include <stddef.h>
 #include "devices/block.h"
 
+/** Sectors per block group, the unit of allocation locality. */
+#define FREE_MAP_GROUP_SECTORS 1024
+
+/** Ticks between flushes of the free map's dirty sectors. */
+#define FREE_MAP_FLUSH_TICKS (5 * TIMER_FREQ)
+
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
@@ -12,6 +18,10 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (block_sector_t goal, size_t, block_sector_t *);
+size_t free_map_extend (block_sector_t, size_t);
 void free_map_release (block_sector_t, size_t);
+bool free_map_reclaim (void);
+void free_map_flush (void);
 
 #endif /**< filesys/free-map.h */
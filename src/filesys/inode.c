@@ -1,23 +1,54 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /** Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/** Extents kept in the inode sector itself, and in each indirect
+   extent block. */
+#define DIRECT_EXTENTS 62
+#define INDIRECT_EXTENTS 63
+
+/** A run of LENGTH sectors starting at START. */
+struct extent
+  {
+    block_sector_t start;               /**< First sector. */
+    uint32_t length;                    /**< Number of sectors. */
+  };
+
 /** On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The file's data is a list of extents, in file order.  The first
+   DIRECT_EXTENTS are here; the rest are in a chain of indirect
+   extent blocks.  A file usually grows by extending its last
+   extent, so even a large file has few extents. */
 struct inode_disk
   {
-    block_sector_t start;               /**< First data sector. */
     off_t length;                       /**< File size in bytes. */
     unsigned magic;                     /**< Magic number. */
-    uint32_t unused[125];               /**< Not used. */
+    uint32_t extent_cnt;                /**< Number of extents. */
+    block_sector_t indirect;            /**< First indirect block, or 0. */
+    struct extent extents[DIRECT_EXTENTS]; /**< First extents. */
+  };
+
+/** Indirect extent block.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct indirect_block
+  {
+    block_sector_t next;                /**< Next indirect block, or 0. */
+    uint32_t unused;                    /**< Not used. */
+    struct extent extents[INDIRECT_EXTENTS]; /**< Further extents. */
   };
 
 /** Returns the number of sectors to allocate for an inode SIZE
@@ -28,40 +59,171 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/** An extent and the first sector of the file it holds. */
+struct extent_ref
+  {
+    block_sector_t first;               /**< File sector of the start. */
+    struct extent ext;                  /**< The extent. */
+  };
+
 /** In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /**< Element in inode list. */
+    struct hash_elem hash_elem;         /**< Element in inode table. */
+    struct list_elem elem;              /**< Element in closed inode LRU. */
     block_sector_t sector;              /**< Sector number of disk location. */
     int open_cnt;                       /**< Number of openers. */
     bool removed;                       /**< True if deleted, false otherwise. */
     int deny_write_cnt;                 /**< 0: writes ok, >0: deny writes. */
+    bool journaled;                     /**< Data is metadata? */
+    bool loading;                       /**< Still being read in? */
+    bool load_failed;                   /**< Reading it in failed? */
     struct inode_disk data;             /**< Inode content. */
+
+    /* Locking: RW is held for reading to read or write the data,
+       and for writing to change the length, the extents or
+       DENY_WRITE_CNT.  DIR_LOCK serializes changes to a directory's
+       entries.  OPEN_CNT, REMOVED, LOADING and LOAD_FAILED belong
+       to INODES_LOCK. */
+    struct rwlock rw;                   /**< Data and metadata lock. */
+    struct lock dir_lock;               /**< Directory lock. */
+
+    /* Extent lookup cache: all of the file's extents, so that
+       finding a sector is a binary search in memory. */
+    struct extent_ref *map;             /**< data.extent_cnt extents. */
+    size_t map_cap;                     /**< Slots allocated in MAP. */
+    size_t map_hint;                    /**< Extent of the last lookup. */
+    block_sector_t *indirect;           /**< Indirect block sectors. */
+    size_t indirect_cnt;                /**< Number of indirect blocks. */
   };
 
+static bool extents_load (struct inode *);
+static bool extents_append (struct inode *, block_sector_t, size_t);
+static bool extents_save (struct inode *, size_t from);
+static void extents_release (struct inode *);
+static bool inode_grow (struct inode *, off_t length);
+
+/** Returns the number of sectors allocated to INODE. */
+static size_t
+allocated_sectors (const struct inode *inode) 
+{
+  const struct extent_ref *last;
+
+  if (inode->data.extent_cnt == 0)
+    return 0;
+  last = &inode->map[inode->data.extent_cnt - 1];
+  return last->first + last->ext.length;
+}
+
 /** Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  const struct extent_ref *ref;
+  block_sector_t sector;
+  size_t lo, hi;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
+  if (pos >= inode->data.length)
     return -1;
+  sector = pos / BLOCK_SECTOR_SIZE;
+
+  /* Sequential access keeps hitting the same extent. */
+  lo = inode->map_hint;
+  ref = &inode->map[lo];
+  if (lo < inode->data.extent_cnt
+      && ref->first <= sector && sector < ref->first + ref->ext.length)
+    return ref->ext.start + (sector - ref->first);
+
+  /* Find the last extent starting at or before SECTOR. */
+  lo = 0;
+  hi = inode->data.extent_cnt;
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (inode->map[mid].first <= sector)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  inode->map_hint = lo;
+  ref = &inode->map[lo];
+  ASSERT (sector < ref->first + ref->ext.length);
+  return ref->ext.start + (sector - ref->first);
+}
+
+/** Table of inodes in memory, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'.  It holds
+   every open inode plus up to inode_cache_size closed ones, which
+   are also on CLOSED_INODES, least recently closed first, and are
+   revived by inode_open() without reading the disk.  An inode being
+   read in is in the table already, marked LOADING, so that the read
+   can be done without INODES_LOCK while other openers of the same
+   inode wait for it on INODE_LOADED. */
+static struct hash inodes;
+static struct list closed_inodes;
+static size_t closed_cnt;
+static struct lock inodes_lock;         /**< Protects the above. */
+static struct condition inode_loaded;   /**< Signaled when a read ends. */
+
+size_t inode_cache_size = INODE_CACHE_SIZE;
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct inode *inode = hash_entry (e, struct inode, hash_elem);
+  return hash_int (inode->sector);
 }
 
-/** List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED) 
+{
+  return (hash_entry (a, struct inode, hash_elem)->sector
+          < hash_entry (b, struct inode, hash_elem)->sector);
+}
 
 /** Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&inodes, inode_hash, inode_less, NULL);
+  list_init (&closed_inodes);
+  lock_init (&inodes_lock);
+  cond_init (&inode_loaded);
+}
+
+/** Returns a new, zeroed in-memory inode for SECTOR, or a null
+   pointer if memory allocation fails. */
+static struct inode *
+inode_alloc (block_sector_t sector) 
+{
+  struct inode *inode = calloc (1, sizeof *inode);
+  if (inode != NULL)
+    {
+      inode->sector = sector;
+      rwlock_init (&inode->rw);
+      lock_init (&inode->dir_lock);
+    }
+  return inode;
+}
+
+/** Frees INODE, which is closed, and its blocks if it was removed. */
+static void
+inode_free (struct inode *inode) 
+{
+  hash_delete (&inodes, &inode->hash_elem);
+  if (inode->removed) 
+    {
+      free_map_release (inode->sector, 1);
+      extents_release (inode);
+    }
+  free (inode->map);
+  free (inode->indirect);
+  free (inode);
 }
 
 /** Initializes an inode with LENGTH bytes of data and
@@ -72,36 +234,27 @@ inode_init (void)
 bool
 inode_create (block_sector_t sector, off_t length)
 {
-  struct inode_disk *disk_inode = NULL;
-  bool success = false;
+  struct inode *inode;
+  bool success;
 
   ASSERT (length >= 0);
 
-  /* If this assertion fails, the inode structure is not exactly
-     one sector in size, and you should fix that. */
-  ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  /* If these assertions fail, the on-disk structures are not
+     exactly one sector in size, and you should fix that. */
+  ASSERT (sizeof (struct inode_disk) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct indirect_block) == BLOCK_SECTOR_SIZE);
 
-  disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-    {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
-    }
+  inode = inode_alloc (sector);
+  if (inode == NULL)
+    return false;
+  inode->data.magic = INODE_MAGIC;
+
+  success = inode_grow (inode, length);
+  if (!success)
+    extents_release (inode);
+  free (inode->map);
+  free (inode->indirect);
+  free (inode);
   return success;
 }
 
@@ -111,33 +264,80 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
+  bool loaded;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already in memory. */
+  lock_acquire (&inodes_lock);
+  key.sector = sector;
+  e = hash_find (&inodes, &key.hash_elem);
+  if (e != NULL) 
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode = hash_entry (e, struct inode, hash_elem);
+      if (inode->open_cnt == 0) 
+        {
+          list_remove (&inode->elem);
+          closed_cnt--;
+        }
+      inode->open_cnt++;
+
+      /* Somebody else is reading it in: wait for them. */
+      while (inode->loading)
+        cond_wait (&inode_loaded, &inodes_lock);
+      if (inode->load_failed)
         {
-          inode_reopen (inode);
-          return inode; 
+          if (--inode->open_cnt == 0)
+            {
+              free (inode->map);
+              free (inode->indirect);
+              free (inode);
+            }
+          inode = NULL;
         }
+      lock_release (&inodes_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = inode_alloc (sector);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-  inode->sector = sector;
+  /* Initialize, and claim the sector before reading it, without
+     INODES_LOCK, so that other opens and closes need not wait for
+     the disk. */
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->loading = true;
+  hash_insert (&inodes, &inode->hash_elem);
+  lock_release (&inodes_lock);
+
+  cache_read (inode->sector, &inode->data);
+  loaded = extents_load (inode);
+
+  lock_acquire (&inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode_loaded, &inodes_lock);
+  if (!loaded)
+    {
+      /* Openers still waiting free it when they see the failure. */
+      hash_delete (&inodes, &inode->hash_elem);
+      inode->load_failed = true;
+      if (--inode->open_cnt == 0)
+        {
+          free (inode->map);
+          free (inode->indirect);
+          free (inode);
+        }
+      inode = NULL;
+    }
+  lock_release (&inodes_lock);
   return inode;
 }
 
@@ -146,7 +346,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inodes_lock);
+      inode->open_cnt++;
+      lock_release (&inodes_lock);
+    }
   return inode;
 }
 
@@ -158,8 +362,8 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /** Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, moves it to the cache
+   of closed inodes, or frees it and its blocks if it was removed. */
 void
 inode_close (struct inode *inode) 
 {
@@ -168,21 +372,27 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&inodes_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      /* Free a removed inode now.  Keep any other in memory for
+         the next inode_open(), evicting the least recently closed
+         one if the cache is full. */
+      if (inode->removed || inode_cache_size == 0)
+        inode_free (inode);
+      else 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          if (closed_cnt == inode_cache_size) 
+            {
+              struct list_elem *e = list_pop_front (&closed_inodes);
+              inode_free (list_entry (e, struct inode, elem));
+              closed_cnt--;
+            }
+          list_push_back (&closed_inodes, &inode->elem);
+          closed_cnt++;
         }
-
-      free (inode); 
     }
+  lock_release (&inodes_lock);
 }
 
 /** Marks INODE to be deleted when it is closed by the last caller who
@@ -191,7 +401,33 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inodes_lock);
   inode->removed = true;
+  lock_release (&inodes_lock);
+}
+
+/** Makes writes to INODE's data, which must be file system
+   metadata such as a directory or the free map, go through the
+   journal. */
+void
+inode_set_journaled (struct inode *inode) 
+{
+  inode->journaled = true;
+}
+
+/** Locks INODE, a directory, against concurrent changes to its
+   entries. */
+void
+inode_dir_lock (struct inode *inode) 
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/** Unlocks INODE, a directory locked with inode_dir_lock(). */
+void
+inode_dir_unlock (struct inode *inode) 
+{
+  lock_release (&inode->dir_lock);
 }
 
 /** Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -202,8 +438,8 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_read (&inode->rw);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -220,99 +456,220 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Copy the chunk out of the buffer cache. */
+      cache_read_at (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rw);
+
+  return bytes_read;
+}
+
+/** Asks for the sectors holding the SIZE bytes of INODE at OFFSET
+   to be read into the buffer cache in the background.  Bytes past
+   the end of INODE are ignored. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size) 
+{
+  off_t end = offset + size;
+
+  rwlock_acquire_read (&inode->rw);
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset -= offset % BLOCK_SECTOR_SIZE; offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    cache_readahead (byte_to_sector (inode, offset));
+  rwlock_release_read (&inode->rw);
+}
+
+/** Reads from INODE, starting at OFFSET, into the CNT buffers of
+   IOV in turn, as much as inode_read_at() would read into a
+   single buffer as long as all of them.  Returns the number of
+   bytes actually read.
+
+   Cached sectors are copied out of the buffer cache, as by
+   inode_read_at(), but a run of whole sectors that are not cached,
+   lie in one buffer and are contiguous on disk is read straight
+   into the buffer with a single device request, without going
+   through the cache.  Such reads are meant for large transfers
+   that would only push more useful sectors out of the cache. */
+off_t
+inode_readv (struct inode *inode, const struct iovec *iov, size_t cnt,
+             off_t offset) 
+{
+  off_t bytes_read = 0;
+  size_t i;
+
+  rwlock_acquire_read (&inode->rw);
+  for (i = 0; i < cnt; i++) 
+    {
+      uint8_t *buffer = iov[i].iov_base;
+      off_t size = iov[i].iov_len;
+
+      while (size > 0) 
+        {
+          /* Disk sector to read, starting byte offset within sector. */
+          block_sector_t sector_idx = byte_to_sector (inode, offset);
+          int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+
+          /* Bytes left in inode, bytes left in sector, lesser of the two. */
+          off_t inode_left = inode_length (inode) - offset;
+          int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+          int min_left = inode_left < sector_left ? inode_left : sector_left;
+
+          /* Number of bytes to actually copy out of this sector. */
+          int chunk_size = size < min_left ? size : min_left;
+          if (chunk_size <= 0)
+            goto done;
+
+          if (chunk_size == BLOCK_SECTOR_SIZE && !cache_contains (sector_idx)) 
+            {
+              /* Extend the run over the following whole sectors. */
+              size_t run = 1;
+
+              while ((off_t) (run + 1) * BLOCK_SECTOR_SIZE <= size
+                     && (off_t) (run + 1) * BLOCK_SECTOR_SIZE <= inode_left
+                     && byte_to_sector (inode,
+                                        offset + run * BLOCK_SECTOR_SIZE)
+                        == sector_idx + run
+                     && !cache_contains (sector_idx + run))
+                run++;
+              block_read_multi (fs_device, sector_idx, run, buffer);
+              chunk_size = run * BLOCK_SECTOR_SIZE;
+            }
+          else
+            cache_read_at (sector_idx, buffer, sector_ofs, chunk_size);
+
+          /* Advance. */
+          size -= chunk_size;
+          offset += chunk_size;
+          buffer += chunk_size;
+          bytes_read += chunk_size;
+        }
+    }
+ done:
+  rwlock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
 /** Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk is full or an error occurs.
+   A write past end of file extends the inode; the bytes between
+   the old end and OFFSET read as zeros. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
                 off_t offset) 
 {
-  const uint8_t *buffer = buffer_;
-  off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  struct iovec iov;
 
-  if (inode->deny_write_cnt)
-    return 0;
+  iov.iov_base = (void *) buffer;
+  iov.iov_len = size;
+  return inode_writev (inode, &iov, 1, offset);
+}
 
-  while (size > 0) 
+/** Writes the CNT buffers of IOV in turn into INODE, starting at
+   OFFSET, as inode_write_at() would write a single buffer holding
+   all of them: the file grows once, to hold the whole write, and
+   the lock and journal handle are taken once.  Returns the number
+   of bytes actually written.  The sum of the buffer lengths must
+   fit in an off_t. */
+off_t
+inode_writev (struct inode *inode, const struct iovec *iov, size_t cnt,
+              off_t offset) 
+{
+  off_t bytes_written = 0;
+  off_t size = 0;
+  bool exclusive = false;
+  bool grow, reclaimed;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    size += iov[i].iov_len;
+  grow = offset + size > inode_length (inode);
+
+  /* Growing changes metadata, so it needs a journal handle, which
+     must be opened before taking the inode's lock. */
+  if (grow)
+    journal_begin ();
+
+  /* Writes within the file share the inode with readers and other
+     writers.  Growing the file to hold the write, or writing what
+     fits if that fails, needs it exclusively. */
+  rwlock_acquire_read (&inode->rw);
+  if (offset + size > inode_length (inode))
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
-
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      rwlock_release_read (&inode->rw);
+      rwlock_acquire_write (&inode->rw);
+      exclusive = true;
+      if (!inode->deny_write_cnt && offset + size > inode_length (inode)
+          && !inode_grow (inode, offset + size) && journal_outermost ())
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* The disk may only be short of sectors waiting for a
+             checkpoint, which needs the handle closed.  A write
+             nested in another handle, such as a directory growing
+             within filesys_create(), just fails and leaves the
+             retry to the outer caller. */
+          rwlock_release_write (&inode->rw);
+          journal_end ();
+          reclaimed = free_map_reclaim ();
+          journal_begin ();
+          rwlock_acquire_write (&inode->rw);
+          if (reclaimed && !inode->deny_write_cnt
+              && offset + size > inode_length (inode))
+            inode_grow (inode, offset + size);
         }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+    }
+  if (inode->deny_write_cnt)
+    cnt = 0;
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
+  for (i = 0; i < cnt; i++) 
+    {
+      const uint8_t *buffer = iov[i].iov_base;
+      size = iov[i].iov_len;
+
+      while (size > 0) 
+        {
+          /* Sector to write, starting byte offset within sector. */
+          block_sector_t sector_idx = byte_to_sector (inode, offset);
+          int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+
+          /* Bytes left in inode, bytes left in sector, lesser of the two. */
+          off_t inode_left = inode_length (inode) - offset;
+          int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+          int min_left = inode_left < sector_left ? inode_left : sector_left;
+
+          /* Number of bytes to actually write into this sector. */
+          int chunk_size = size < min_left ? size : min_left;
+          if (chunk_size <= 0)
+            goto done;
+
+          /* Copy the chunk into the buffer cache.  The cache only
+             reads the sector first if the chunk does not cover it. */
+          if (inode->journaled)
+            journal_write_at (sector_idx, buffer, sector_ofs, chunk_size);
           else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+            cache_write_at (sector_idx, buffer, sector_ofs, chunk_size);
 
-      /* Advance. */
-      size -= chunk_size;
-      offset += chunk_size;
-      bytes_written += chunk_size;
+          /* Advance. */
+          size -= chunk_size;
+          offset += chunk_size;
+          buffer += chunk_size;
+          bytes_written += chunk_size;
+        }
     }
-  free (bounce);
+ done:
+  if (exclusive)
+    rwlock_release_write (&inode->rw);
+  else
+    rwlock_release_read (&inode->rw);
+  if (grow)
+    journal_end ();
 
   return bytes_written;
 }
@@ -322,8 +679,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rw);
 }
 
 /** Re-enables writes to INODE.
@@ -332,14 +691,240 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rw);
 }
 
-/** Returns the length, in bytes, of INODE's data. */
+/** Returns the length, in bytes, of INODE's data.  The length
+   only changes with INODE locked for writing, and is read here in
+   a single access, so no lock is needed. */
 off_t
 inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/** Makes INODE LENGTH bytes long, if it is shorter, allocating and
+   zeroing the sectors it needs.  New sectors extend the last
+   extent in place when the sectors after it are free, so a file
+   written sequentially stays contiguous.  Returns false if the
+   disk is full; sectors allocated by then stay with the file. */
+static bool
+inode_grow (struct inode *inode, off_t length) 
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t have = allocated_sectors (inode);
+  size_t need = bytes_to_sectors (length);
+  size_t changed = inode->data.extent_cnt > 0 ? inode->data.extent_cnt - 1 : 0;
+  bool success = true;
+
+  while (have < need)
+    {
+      block_sector_t start = inode->sector + 1;
+      size_t want = need - have;
+      size_t cnt = 0, i;
+
+      /* Allocating a block group at a time keeps the free map
+         sectors each allocation writes within the journal
+         handle's budget. */
+      if (want > FREE_MAP_GROUP_SECTORS)
+        want = FREE_MAP_GROUP_SECTORS;
+      if (inode->data.extent_cnt > 0)
+        {
+          const struct extent *last
+            = &inode->map[inode->data.extent_cnt - 1].ext;
+          start = last->start + last->length;
+          cnt = free_map_extend (start, want);
+        }
+      if (cnt == 0)
+        {
+          /* Start a new extent, as long as a free run allows, as
+             near as possible to the end of the file's data or, for
+             an empty file, to the inode itself. */
+          for (cnt = want; cnt > 0; cnt /= 2)
+            if (free_map_allocate_near (start, cnt, &start))
+              break;
+          if (cnt == 0)
+            {
+              success = false;
+              break;
+            }
+        }
+
+      for (i = 0; i < cnt; i++)
+        cache_write (start + i, zeros);
+      if (!extents_append (inode, start, cnt))
+        {
+          free_map_release (start, cnt);
+          success = false;
+          break;
+        }
+      have += cnt;
+    }
+
+  if (success && length > inode->data.length)
+    inode->data.length = length;
+  return extents_save (inode, changed) && success;
+}
+
+/** Reads INODE's extents, from the inode and its indirect blocks,
+   into its lookup cache. */
+static bool
+extents_load (struct inode *inode) 
+{
+  struct indirect_block *block = NULL;
+  block_sector_t next = inode->data.indirect;
+  size_t cnt = inode->data.extent_cnt;
+  block_sector_t first = 0;
+  size_t i;
+
+  inode->map = malloc ((cnt > 0 ? cnt : 1) * sizeof *inode->map);
+  inode->map_cap = cnt > 0 ? cnt : 1;
+  inode->indirect_cnt = 0;
+  if (cnt > DIRECT_EXTENTS)
+    {
+      size_t blocks = DIV_ROUND_UP (cnt - DIRECT_EXTENTS, INDIRECT_EXTENTS);
+      inode->indirect = malloc (blocks * sizeof *inode->indirect);
+      block = malloc (sizeof *block);
+      if (inode->indirect == NULL || block == NULL)
+        {
+          free (block);
+          return false;
+        }
+    }
+  if (inode->map == NULL)
+    return false;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct extent_ref *ref = &inode->map[i];
+
+      if (i < DIRECT_EXTENTS)
+        ref->ext = inode->data.extents[i];
+      else
+        {
+          size_t j = (i - DIRECT_EXTENTS) % INDIRECT_EXTENTS;
+          if (j == 0)
+            {
+              inode->indirect[inode->indirect_cnt++] = next;
+              cache_read (next, block);
+              next = block->next;
+            }
+          ref->ext = block->extents[j];
+        }
+      ref->first = first;
+      first += ref->ext.length;
+    }
+  free (block);
+  return true;
+}
+
+/** Adds the CNT sectors starting at START to the end of INODE's
+   data, merging them into the last extent if they follow it. */
+static bool
+extents_append (struct inode *inode, block_sector_t start, size_t cnt) 
+{
+  size_t n = inode->data.extent_cnt;
+  struct extent_ref *ref;
+
+  if (n > 0)
+    {
+      ref = &inode->map[n - 1];
+      if (ref->ext.start + ref->ext.length == start)
+        {
+          ref->ext.length += cnt;
+          return true;
+        }
+    }
+
+  if (n == inode->map_cap)
+    {
+      size_t cap = inode->map_cap > 0 ? inode->map_cap * 2 : 4;
+      struct extent_ref *map = realloc (inode->map, cap * sizeof *map);
+      if (map == NULL)
+        return false;
+      inode->map = map;
+      inode->map_cap = cap;
+    }
+  ref = &inode->map[n];
+  ref->first = allocated_sectors (inode);
+  ref->ext.start = start;
+  ref->ext.length = cnt;
+  inode->data.extent_cnt++;
+  return true;
+}
+
+/** Writes INODE, with its extents from index FROM on, to disk,
+   allocating indirect blocks as needed. */
+static bool
+extents_save (struct inode *inode, size_t from) 
+{
+  size_t cnt = inode->data.extent_cnt;
+  size_t i;
+
+  for (i = from; i < cnt && i < DIRECT_EXTENTS; i++)
+    inode->data.extents[i] = inode->map[i].ext;
+
+  if (cnt > DIRECT_EXTENTS)
+    {
+      size_t blocks = DIV_ROUND_UP (cnt - DIRECT_EXTENTS, INDIRECT_EXTENTS);
+      size_t first_block = from < DIRECT_EXTENTS
+                           ? 0 : (from - DIRECT_EXTENTS) / INDIRECT_EXTENTS;
+      struct indirect_block *block;
+
+      /* A new block must be linked from the one before it. */
+      if (inode->indirect_cnt < blocks && inode->indirect_cnt > 0
+          && inode->indirect_cnt - 1 < first_block)
+        first_block = inode->indirect_cnt - 1;
+      while (inode->indirect_cnt < blocks)
+        {
+          block_sector_t *indirect
+            = realloc (inode->indirect, blocks * sizeof *indirect);
+          if (indirect == NULL)
+            return false;
+          inode->indirect = indirect;
+          if (!free_map_allocate_near (inode->sector, 1,
+                                       &indirect[inode->indirect_cnt]))
+            return false;
+          inode->indirect_cnt++;
+        }
+
+      block = malloc (sizeof *block);
+      if (block == NULL)
+        return false;
+      for (i = first_block; i < blocks; i++)
+        {
+          size_t j;
+
+          memset (block, 0, sizeof *block);
+          block->next = i + 1 < blocks ? inode->indirect[i + 1] : 0;
+          for (j = 0; j < INDIRECT_EXTENTS; j++)
+            {
+              size_t k = DIRECT_EXTENTS + i * INDIRECT_EXTENTS + j;
+              if (k < cnt)
+                block->extents[j] = inode->map[k].ext;
+            }
+          journal_write (inode->indirect[i], block);
+        }
+      free (block);
+    }
+
+  inode->data.indirect = inode->indirect_cnt > 0 ? inode->indirect[0] : 0;
+  journal_write (inode->sector, &inode->data);
+  return true;
+}
+
+/** Frees the data sectors and indirect blocks of INODE. */
+static void
+extents_release (struct inode *inode) 
+{
+  size_t i;
+
+  for (i = 0; i < inode->data.extent_cnt; i++)
+    free_map_release (inode->map[i].ext.start, inode->map[i].ext.length);
+  for (i = 0; i < inode->indirect_cnt; i++)
+    free_map_release (inode->indirect[i], 1);
+}
@@ -2,11 +2,19 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <iovec.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
 struct bitmap;
 
+/** Default number of closed inodes kept in memory. */
+#define INODE_CACHE_SIZE 64
+
+/** Closed inodes kept in memory, set with -icache. */
+extern size_t inode_cache_size;
+
 void inode_init (void);
 bool inode_create (block_sector_t, off_t);
 struct inode *inode_open (block_sector_t);
@@ -14,8 +22,16 @@ struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+void inode_set_journaled (struct inode *);
+void inode_dir_lock (struct inode *);
+void inode_dir_unlock (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t offset, off_t size);
+off_t inode_readv (struct inode *, const struct iovec *, size_t cnt,
+                   off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_writev (struct inode *, const struct iovec *, size_t cnt,
+                    off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
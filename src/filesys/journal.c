@@ -0,0 +1,438 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/** Identify journal blocks. */
+#define JOURNAL_MAGIC 0x4a524e4c        /**< Header, "JRNL". */
+#define DESC_MAGIC 0x44455343           /**< Descriptor, "DESC". */
+#define COMMIT_MAGIC 0x434d4954         /**< Commit block, "CMIT". */
+
+/** Sectors listed in one descriptor block. */
+#define DESC_SECTORS 125
+
+/** Journal header, in sector JOURNAL_SECTOR.  Rewritten only by
+   checkpoints, so it points at the oldest transaction that may
+   still need replaying. */
+struct journal_header
+  {
+    uint32_t magic;                     /**< JOURNAL_MAGIC. */
+    block_sector_t start;               /**< First sector of the log. */
+    uint32_t size;                      /**< Log size in sectors. */
+    uint32_t tail;                      /**< Log offset of the first record. */
+    uint32_t seq;                       /**< Sequence number of that record. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 20];
+  };
+
+/** Descriptor block, the start of a transaction in the log.  It
+   is followed by the new contents of each sector it lists, then
+   by a commit block. */
+struct journal_desc
+  {
+    uint32_t magic;                     /**< DESC_MAGIC. */
+    uint32_t seq;                       /**< Transaction sequence number. */
+    uint32_t cnt;                       /**< Number of sectors. */
+    block_sector_t sectors[DESC_SECTORS]; /**< Home of each sector. */
+  };
+
+/** Commit block.  A transaction counts only once this is written. */
+struct journal_commit
+  {
+    uint32_t magic;                     /**< COMMIT_MAGIC. */
+    uint32_t seq;                       /**< Transaction sequence number. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8];
+  };
+
+static struct journal_header header;    /**< In-memory header. */
+static bool active;                     /**< Journaling started? */
+
+/** Log state.  HEAD and TAIL count sectors appended to the log
+   since mount, so HEAD - TAIL is the space in use; the log wraps
+   around modulo its size. */
+static uint32_t head;                   /**< Where the next record goes. */
+static uint32_t tail;                   /**< Oldest record still needed. */
+static unsigned seq;                    /**< Running transaction. */
+
+/** The running transaction. */
+static block_sector_t running[DESC_SECTORS]; /**< Sectors it changed. */
+static size_t running_cnt;
+
+static struct lock journal_lock;        /**< Protects all of the above. */
+static struct condition handles_done;   /**< Signaled when HANDLES drops to 0. */
+static struct condition handles_ok;     /**< Signaled when commit ends. */
+static int handles;                     /**< Open handles. */
+static int reserved;                    /**< Sectors they may still add. */
+static bool committing;                 /**< Commit waiting or running? */
+
+/** Statistics. */
+static unsigned long long commit_cnt;   /**< Transactions committed. */
+static unsigned long long logged_cnt;   /**< Sectors written to the log. */
+static unsigned long long checkpoint_cnt; /**< Checkpoints. */
+static unsigned long long handle_cnt;   /**< Handles opened. */
+
+static thread_func committer NO_RETURN;
+static void commit (bool checkpoint);
+static void write_header (void);
+
+/** Returns the device sector at log offset POS. */
+static block_sector_t
+log_sector (uint32_t pos)
+{
+  return header.start + pos % header.size;
+}
+
+/** Creates an empty journal while formatting the file system. */
+void
+journal_create (void)
+{
+  static uint8_t zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t start;
+  uint32_t i;
+
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_desc) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_commit) == BLOCK_SECTOR_SIZE);
+
+  if (!free_map_allocate_near (JOURNAL_SECTOR, JOURNAL_SECTORS, &start))
+    PANIC ("journal creation failed");
+
+  /* Clear the log, so that records left by an earlier file system
+     on this disk cannot be mistaken for ours. */
+  for (i = 0; i < JOURNAL_SECTORS; i++)
+    block_write (fs_device, start + i, zeros);
+
+  memset (&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  header.start = start;
+  header.size = JOURNAL_SECTORS;
+  header.tail = 0;
+  header.seq = 1;
+  write_header ();
+}
+
+/** Reads the journal, replays the transactions committed to it,
+   and starts journaling. */
+void
+journal_open (void)
+{
+  struct journal_desc *desc = malloc (sizeof *desc);
+  struct journal_commit *cb = malloc (sizeof *cb);
+  uint8_t *buf = malloc (BLOCK_SECTOR_SIZE);
+  unsigned replayed = 0;
+
+  if (desc == NULL || cb == NULL || buf == NULL)
+    PANIC ("out of memory reading journal");
+
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC || header.size == 0)
+    PANIC ("no journal on file system device (reformat with -f)");
+
+  /* Pinned sectors cannot be evicted, so the cache must keep room
+     for everything else. */
+  ASSERT (JOURNAL_TXN_SECTORS <= CACHE_SECTORS / 2);
+
+  lock_init (&journal_lock);
+  cond_init (&handles_done);
+  cond_init (&handles_ok);
+  head = tail = header.tail;
+  seq = header.seq;
+
+  /* Replay, in order, every transaction whose commit block made it
+     to disk.  The first record out of sequence ends the log. */
+  for (;;)
+    {
+      uint32_t i;
+
+      block_read (fs_device, log_sector (head), desc);
+      if (desc->magic != DESC_MAGIC || desc->seq != seq
+          || desc->cnt == 0 || desc->cnt > DESC_SECTORS
+          || head - tail + desc->cnt + 2 > header.size)
+        break;
+      block_read (fs_device, log_sector (head + desc->cnt + 1), cb);
+      if (cb->magic != COMMIT_MAGIC || cb->seq != seq)
+        break;
+
+      for (i = 0; i < desc->cnt; i++)
+        {
+          block_read (fs_device, log_sector (head + 1 + i), buf);
+          block_write (fs_device, desc->sectors[i], buf);
+        }
+      head += desc->cnt + 2;
+      seq++;
+      replayed++;
+    }
+  if (replayed > 0)
+    {
+      printf ("journal: replayed %u transactions\n", replayed);
+      tail = head;
+      header.tail = tail % header.size;
+      header.seq = seq;
+      write_header ();
+    }
+
+  free (desc);
+  free (cb);
+  free (buf);
+
+  active = true;
+  thread_create ("jcommit", PRI_DEFAULT, committer, NULL);
+}
+
+/** Commits and checkpoints the journal and stops journaling, at
+   shutdown. */
+void
+journal_done (void)
+{
+  if (!active)
+    return;
+  lock_acquire (&journal_lock);
+  commit (true);
+  active = false;
+  lock_release (&journal_lock);
+}
+
+/** Opens a handle: the metadata changes made until the matching
+   journal_end() all go into one transaction.  Waits while a commit
+   is in progress, and commits first, once the open handles close,
+   if JOURNAL_MAX_HANDLES are open or the running transaction might
+   not have room for another handle's sectors. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!active || t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  for (;;)
+    {
+      if (committing)
+        cond_wait (&handles_ok, &journal_lock);
+      else if (handles >= JOURNAL_MAX_HANDLES
+               || running_cnt + reserved + JOURNAL_HANDLE_SECTORS
+                  > JOURNAL_TXN_SECTORS)
+        commit (false);
+      else
+        break;
+    }
+  handles++;
+  handle_cnt++;
+  reserved += JOURNAL_HANDLE_SECTORS;
+  t->journal_cnt = 0;
+  lock_release (&journal_lock);
+}
+
+/** Closes the handle opened by the matching journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!active)
+    return;
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  reserved -= JOURNAL_HANDLE_SECTORS - t->journal_cnt;
+  if (--handles == 0)
+    cond_broadcast (&handles_done, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/** Returns true unless the current thread's handle is nested in
+   another, so that closing it lets a commit or checkpoint go
+   ahead. */
+bool
+journal_outermost (void)
+{
+  return thread_current ()->journal_depth <= 1;
+}
+
+/** Writes SIZE bytes from BUFFER at byte OFS of metadata sector
+   SECTOR, as part of the running transaction.  The caller must
+   hold a handle, and a sector new to the transaction counts
+   against its JOURNAL_HANDLE_SECTORS.  Before journaling starts,
+   just writes through the buffer cache. */
+void
+journal_write_at (block_sector_t sector, const void *buffer, size_t ofs,
+                  size_t size)
+{
+  struct thread *t = thread_current ();
+
+  if (!active)
+    {
+      cache_write_at (sector, buffer, ofs, size);
+      return;
+    }
+
+  ASSERT (t->journal_depth > 0);
+  if (cache_write_pinned (sector, buffer, ofs, size))
+    {
+      lock_acquire (&journal_lock);
+      if (running_cnt == DESC_SECTORS)
+        PANIC ("journal transaction too large");
+      ASSERT (t->journal_cnt < JOURNAL_HANDLE_SECTORS);
+      t->journal_cnt++;
+      reserved--;
+      running[running_cnt++] = sector;
+      lock_release (&journal_lock);
+    }
+}
+
+/** Writes BLOCK_SECTOR_SIZE bytes from BUFFER to metadata sector
+   SECTOR, like journal_write_at(). */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  journal_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/** Commits the running transaction.  The caller must not hold a
+   handle. */
+void
+journal_commit (void)
+{
+  if (!active)
+    return;
+  ASSERT (thread_current ()->journal_depth == 0);
+  lock_acquire (&journal_lock);
+  commit (false);
+  lock_release (&journal_lock);
+}
+
+/** Commits the running transaction and checkpoints, so that every
+   transaction so far is at its home location and out of the log.
+   The caller must not hold a handle. */
+void
+journal_checkpoint (void)
+{
+  if (!active)
+    return;
+  ASSERT (thread_current ()->journal_depth == 0);
+  lock_acquire (&journal_lock);
+  commit (true);
+  lock_release (&journal_lock);
+}
+
+/** Returns the sequence number of the running transaction. */
+unsigned
+journal_seq (void)
+{
+  return active ? seq : 0;
+}
+
+/** Returns the sequence number of the last transaction that has
+   been checkpointed, so that no record of it or anything before
+   it is left in the log. */
+unsigned
+journal_checkpointed_seq (void)
+{
+  return header.seq - 1;
+}
+
+/** Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %llu handles, %llu commits, %llu sectors logged, "
+          "%llu checkpoints\n",
+          handle_cnt, commit_cnt, logged_cnt, checkpoint_cnt);
+}
+
+/** Waits for open handles to close, then writes the running
+   transaction to the log, and checkpoints if CHECKPOINT is true or
+   the log is more than half full.  Must be called with
+   journal_lock held, and without a handle. */
+static void
+commit (bool checkpoint)
+{
+  static struct journal_desc desc;
+  static struct journal_commit cb;
+  static uint8_t buf[BLOCK_SECTOR_SIZE];
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+
+  while (committing)
+    cond_wait (&handles_ok, &journal_lock);
+  committing = true;
+  while (handles > 0)
+    cond_wait (&handles_done, &journal_lock);
+
+  if (running_cnt > 0)
+    {
+      /* After a checkpoint the log is at least half empty, which is
+         room for the largest transaction. */
+      ASSERT (head - tail + running_cnt + 2 <= header.size);
+
+      memset (&desc, 0, sizeof desc);
+      desc.magic = DESC_MAGIC;
+      desc.seq = seq;
+      desc.cnt = running_cnt;
+      memcpy (desc.sectors, running, running_cnt * sizeof *running);
+      block_write (fs_device, log_sector (head), &desc);
+      for (i = 0; i < running_cnt; i++)
+        {
+          cache_read (running[i], buf);
+          block_write (fs_device, log_sector (head + 1 + i), buf);
+        }
+
+      memset (&cb, 0, sizeof cb);
+      cb.magic = COMMIT_MAGIC;
+      cb.seq = seq;
+      block_write (fs_device, log_sector (head + running_cnt + 1), &cb);
+
+      /* Committed: the sectors may go home now. */
+      for (i = 0; i < running_cnt; i++)
+        cache_unpin (running[i]);
+      head += running_cnt + 2;
+      logged_cnt += running_cnt;
+      commit_cnt++;
+      running_cnt = 0;
+      seq++;
+    }
+
+  if ((checkpoint && tail != head) || head - tail > header.size / 2)
+    {
+      /* Nothing is pinned now, so the flush writes home everything
+         the log holds. */
+      cache_flush ();
+      tail = head;
+      header.tail = tail % header.size;
+      header.seq = seq;
+      write_header ();
+      checkpoint_cnt++;
+    }
+
+  committing = false;
+  cond_broadcast (&handles_ok, &journal_lock);
+}
+
+/** Writes the journal header to disk. */
+static void
+write_header (void)
+{
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/** Commits the running transaction every JOURNAL_COMMIT_TICKS. */
+static void
+committer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (JOURNAL_COMMIT_TICKS);
+      journal_commit ();
+    }
+}
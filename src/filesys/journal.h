@@ -0,0 +1,61 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/** Metadata journal.
+
+   File system metadata -- inodes, indirect extent blocks,
+   directories and the free map -- is changed inside handles,
+   opened with journal_begin() and closed with journal_end(), and
+   written with journal_write_at().  The sectors written are
+   pinned in the buffer cache, so they cannot reach their home
+   locations yet, and join the running transaction.
+
+   Every JOURNAL_COMMIT_TICKS, or sooner if the running
+   transaction fills up, it is committed: once its open handles
+   close, the sectors it changed, from however many system calls,
+   are appended to the log in one sequential run of a descriptor
+   block, their contents, and a commit block.  Then they are
+   unpinned and the buffer cache writes them home whenever it
+   likes.  When the log is more than half full, a commit also
+   checkpoints: it flushes the cache and starts the log over.
+
+   At mount, the committed transactions still in the log are
+   replayed, so after a crash the metadata is as of the last
+   commit.
+
+   A thread must not start a handle while holding a lock that a
+   thread with an open handle may wait for, since a commit waits
+   for every handle to close.  Handles nest, and a handle, with
+   those nested in it, may add at most JOURNAL_HANDLE_SECTORS
+   sectors to the transaction; at most JOURNAL_MAX_HANDLES are
+   open at once, so a transaction never pins more of the buffer
+   cache than JOURNAL_TXN_SECTORS. */
+
+#define JOURNAL_SECTORS 256             /**< Log size, in sectors. */
+#define JOURNAL_TXN_SECTORS 32          /**< Sectors per transaction. */
+#define JOURNAL_HANDLE_SECTORS 8        /**< Sectors per handle. */
+#define JOURNAL_MAX_HANDLES (JOURNAL_TXN_SECTORS / JOURNAL_HANDLE_SECTORS)
+#define JOURNAL_COMMIT_TICKS (TIMER_FREQ / 2) /**< Commit period. */
+
+void journal_create (void);
+void journal_open (void);
+void journal_done (void);
+
+void journal_begin (void);
+void journal_end (void);
+bool journal_outermost (void);
+void journal_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+void journal_write (block_sector_t, const void *);
+
+void journal_commit (void);
+void journal_checkpoint (void);
+unsigned journal_seq (void);
+unsigned journal_checkpointed_seq (void);
+
+void journal_print_stats (void);
+
+#endif /**< filesys/journal.h */
@@ -0,0 +1,17 @@
+#ifndef __LIB_IOVEC_H
+#define __LIB_IOVEC_H
+
+#include <stddef.h>
+
+/** One buffer of a scatter-gather transfer, for readv() and
+   writev() and the file system functions behind them. */
+struct iovec
+  {
+    void *iov_base;             /**< Start of the buffer. */
+    size_t iov_len;             /**< Length of the buffer in bytes. */
+  };
+
+/** Most buffers in one readv() or writev() call. */
+#define IOV_MAX 64
+
+#endif /**< lib/iovec.h */
@@ -358,6 +358,25 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/** Writes the part of B that holds the CNT bits starting at START
+   to the same place in FILE, as bitmap_write() would lay it out.
+   Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t ofs = start / CHAR_BIT;
+  off_t end = DIV_ROUND_UP (start + cnt, CHAR_BIT);
+
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (cnt <= b->bit_cnt - start);
+
+  if (end <= ofs)
+    return true;
+  return file_write_at (file, (const char *) b->bits + ofs,
+                        end - ofs, ofs) == end - ofs;
+}
 #endif /**< FILESYS */
 
 /** Debugging. */
@@ -0,0 +1,171 @@
+#include "lz.h"
+#include <string.h>
+
+/** Longest literal run one control byte can introduce. */
+#define MAX_LIT 32
+
+/** Farthest back a reference can point. */
+#define MAX_OFF 8192
+
+/** Longest match a reference can describe. */
+#define MAX_REF (7 + 255 + 2)
+
+/** Hashes the three bytes at P into the compressor's table. */
+static inline unsigned
+hash3 (const uint8_t *p) 
+{
+  uint32_t v = ((uint32_t) p[0] << 16) | ((uint32_t) p[1] << 8) | p[2];
+  return (v * 2654435761u) >> 22;
+}
+
+/** Compresses SRC_LEN bytes at SRC into DST, which can hold
+   DST_CAP bytes.  HTAB is scratch space for the compressor, so
+   that callers can keep it off their stack.
+   Returns the compressed size, or 0 if the output would not fit
+   in DST_CAP bytes. */
+size_t
+lz_compress (const void *src, size_t src_len, void *dst, size_t dst_cap,
+             uint16_t htab[LZ_HTAB_SIZE]) 
+{
+  const uint8_t *in = src;
+  const uint8_t *ip = in;
+  const uint8_t *in_end = in + src_len;
+  uint8_t *out = dst;
+  uint8_t *op = out;
+  uint8_t *out_end = out + dst_cap;
+  uint8_t *lit_ctrl;
+  size_t lit = 0;
+
+  if (src_len == 0 || dst_cap == 0)
+    return 0;
+
+  /* Positions are stored plus one, so that 0 means empty. */
+  memset (htab, 0, LZ_HTAB_SIZE * sizeof *htab);
+
+  /* Every item starts with a literal run, possibly empty. */
+  lit_ctrl = op++;
+
+  while (ip < in_end) 
+    {
+      if (ip + 2 < in_end)
+        {
+          unsigned h = hash3 (ip);
+          size_t ref_pos = htab[h];
+          htab[h] = ip - in + 1;
+
+          if (ref_pos != 0) 
+            {
+              const uint8_t *ref = in + ref_pos - 1;
+              size_t off = ip - ref - 1;
+
+              if (off < MAX_OFF
+                  && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) 
+                {
+                  size_t max_len = in_end - ip < MAX_REF ? in_end - ip : MAX_REF;
+                  size_t len = 3;
+                  size_t code;
+
+                  while (len < max_len && ref[len] == ip[len])
+                    len++;
+
+                  /* Close the pending literal run. */
+                  if (lit == 0)
+                    op--;
+                  else
+                    *lit_ctrl = lit - 1;
+
+                  /* Reference plus the control byte of the next run. */
+                  if (out_end - op < 4)
+                    return 0;
+                  code = len - 2;
+                  if (code < 7)
+                    *op++ = (code << 5) | (off >> 8);
+                  else 
+                    {
+                      *op++ = (7 << 5) | (off >> 8);
+                      *op++ = code - 7;
+                    }
+                  *op++ = off & 0xff;
+
+                  ip += len;
+                  lit_ctrl = op++;
+                  lit = 0;
+                  continue;
+                }
+            }
+        }
+
+      /* Copy one literal. */
+      if (op >= out_end)
+        return 0;
+      *op++ = *ip++;
+      if (++lit == MAX_LIT) 
+        {
+          *lit_ctrl = lit - 1;
+          if (op >= out_end)
+            return 0;
+          lit_ctrl = op++;
+          lit = 0;
+        }
+    }
+
+  if (lit == 0)
+    op--;
+  else
+    *lit_ctrl = lit - 1;
+  return op - out;
+}
+
+/** Decompresses SRC_LEN bytes at SRC, produced by lz_compress(),
+   into DST, which can hold DST_CAP bytes.
+   Returns the decompressed size, or 0 if SRC is corrupt or does
+   not fit in DST_CAP bytes. */
+size_t
+lz_decompress (const void *src, size_t src_len, void *dst, size_t dst_cap) 
+{
+  const uint8_t *ip = src;
+  const uint8_t *in_end = ip + src_len;
+  uint8_t *out = dst;
+  uint8_t *op = out;
+  uint8_t *out_end = out + dst_cap;
+
+  while (ip < in_end) 
+    {
+      unsigned ctrl = *ip++;
+
+      if (ctrl < MAX_LIT) 
+        {
+          size_t len = ctrl + 1;
+          if ((size_t) (in_end - ip) < len || (size_t) (out_end - op) < len)
+            return 0;
+          memcpy (op, ip, len);
+          op += len;
+          ip += len;
+        }
+      else 
+        {
+          size_t len = ctrl >> 5;
+          size_t off;
+          const uint8_t *ref;
+
+          if (len == 7) 
+            {
+              if (ip >= in_end)
+                return 0;
+              len += *ip++;
+            }
+          if (ip >= in_end)
+            return 0;
+          off = ((ctrl & 0x1f) << 8) + *ip++ + 1;
+          len += 2;
+
+          if ((size_t) (op - out) < off || (size_t) (out_end - op) < len)
+            return 0;
+
+          /* Byte by byte: the source may overlap the destination. */
+          for (ref = op - off; len > 0; len--)
+            *op++ = *ref++;
+        }
+    }
+  return op - out;
+}
@@ -0,0 +1,31 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+/** LZ77-family byte compressor.
+
+   A small, fast compressor in the style of LZF, meant for
+   compressing pages in memory rather than for good ratios.  The
+   compressed stream is a series of items, each introduced by a
+   control byte C:
+
+     - C < 32: a run of C + 1 literal bytes follows.
+
+     - C >= 32: a back-reference.  The length is (C >> 5) + 2, or
+       if C >> 5 is 7, 9 plus the next byte.  The distance back is
+       1 plus ((C & 0x1f) << 8) plus the byte after that.
+
+   Back-references reach at most 8 kB, which covers a page. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Number of entries in the hash table used by lz_compress(). */
+#define LZ_HTAB_SIZE 1024
+
+size_t lz_compress (const void *src, size_t src_len,
+                    void *dst, size_t dst_cap,
+                    uint16_t htab[LZ_HTAB_SIZE]);
+size_t lz_decompress (const void *src, size_t src_len,
+                      void *dst, size_t dst_cap);
+
+#endif /**< lib/kernel/lz.h */
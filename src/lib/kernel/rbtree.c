@@ -0,0 +1,468 @@
+/** Red-black tree.
+
+   The usual rules: every node is red or black, the root is
+   black, a red node has no red child, and every path from a
+   node down to a missing child passes the same number of black
+   nodes.  Missing children are null pointers and count as
+   black.
+
+   See rbtree.h for basic information. */
+
+#include "rbtree.h"
+#include "../debug.h"
+
+static bool is_red (const struct rb_elem *);
+static void rotate_left (struct rbtree *, struct rb_elem *);
+static void rotate_right (struct rbtree *, struct rb_elem *);
+static void replace_child (struct rbtree *, struct rb_elem *old,
+                           struct rb_elem *new);
+static void insert_fixup (struct rbtree *, struct rb_elem *);
+static void delete_fixup (struct rbtree *, struct rb_elem *,
+                          struct rb_elem *parent);
+
+/** Initializes tree T to compare elements using LESS, given
+   auxiliary data AUX. */
+void
+rb_init (struct rbtree *t, rb_less_func *less, void *aux)
+{
+  t->root = NULL;
+  t->elem_cnt = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/** Removes all the elements from T.
+
+   If DESTRUCTOR is non-null, then it is called for each element
+   in the tree, children before their parents, so DESTRUCTOR may
+   deallocate the memory used by the element.  Modifying T while
+   rb_clear() is running yields undefined behavior. */
+void
+rb_clear (struct rbtree *t, rb_action_func *destructor)
+{
+  struct rb_elem *e = t->root;
+
+  while (destructor != NULL && e != NULL)
+    {
+      if (e->left != NULL)
+        e = e->left;
+      else if (e->right != NULL)
+        e = e->right;
+      else
+        {
+          /* A leaf: unhook it from its parent, then destroy it. */
+          struct rb_elem *parent = e->parent;
+
+          if (parent != NULL)
+            {
+              if (parent->left == e)
+                parent->left = NULL;
+              else
+                parent->right = NULL;
+            }
+          destructor (e, t->aux);
+          e = parent;
+        }
+    }
+
+  t->root = NULL;
+  t->elem_cnt = 0;
+}
+
+/** Inserts NEW into tree T and returns a null pointer, if no
+   equal element is already in the tree.
+   If an equal element is already in the tree, returns it
+   without inserting NEW. */
+struct rb_elem *
+rb_insert (struct rbtree *t, struct rb_elem *new)
+{
+  struct rb_elem *parent = NULL;
+  struct rb_elem **link = &t->root;
+
+  while (*link != NULL)
+    {
+      parent = *link;
+      if (t->less (new, parent, t->aux))
+        link = &parent->left;
+      else if (t->less (parent, new, t->aux))
+        link = &parent->right;
+      else
+        return parent;
+    }
+
+  new->parent = parent;
+  new->left = new->right = NULL;
+  new->red = true;
+  *link = new;
+  t->elem_cnt++;
+
+  insert_fixup (t, new);
+  return NULL;
+}
+
+/** Finds and returns an element equal to E in tree T, or a null
+   pointer if no equal element exists in the tree. */
+struct rb_elem *
+rb_find (struct rbtree *t, const struct rb_elem *e)
+{
+  struct rb_elem *node = t->root;
+
+  while (node != NULL)
+    {
+      if (t->less (e, node, t->aux))
+        node = node->left;
+      else if (t->less (node, e, t->aux))
+        node = node->right;
+      else
+        return node;
+    }
+  return NULL;
+}
+
+/** Returns the greatest element of T that is less than or equal
+   to E, or a null pointer if every element is greater than E. */
+struct rb_elem *
+rb_floor (struct rbtree *t, const struct rb_elem *e)
+{
+  struct rb_elem *node = t->root;
+  struct rb_elem *best = NULL;
+
+  while (node != NULL)
+    {
+      if (t->less (e, node, t->aux))
+        node = node->left;
+      else
+        {
+          best = node;
+          node = node->right;
+        }
+    }
+  return best;
+}
+
+/** Returns the least element of T that is greater than or equal
+   to E, or a null pointer if every element is less than E. */
+struct rb_elem *
+rb_ceil (struct rbtree *t, const struct rb_elem *e)
+{
+  struct rb_elem *node = t->root;
+  struct rb_elem *best = NULL;
+
+  while (node != NULL)
+    {
+      if (t->less (node, e, t->aux))
+        node = node->right;
+      else
+        {
+          best = node;
+          node = node->left;
+        }
+    }
+  return best;
+}
+
+/** Removes E, which must be in tree T, from T. */
+void
+rb_delete (struct rbtree *t, struct rb_elem *e)
+{
+  struct rb_elem *child, *parent;
+  bool removed_red;
+
+  ASSERT (t->elem_cnt > 0);
+
+  if (e->left != NULL && e->right != NULL)
+    {
+      /* Two children: E's successor, which has no left child,
+         takes E's place and color. */
+      struct rb_elem *next = e->right;
+
+      while (next->left != NULL)
+        next = next->left;
+
+      removed_red = next->red;
+      child = next->right;
+      if (next->parent == e)
+        parent = next;
+      else
+        {
+          parent = next->parent;
+          parent->left = child;
+          if (child != NULL)
+            child->parent = parent;
+          next->right = e->right;
+          next->right->parent = next;
+        }
+
+      replace_child (t, e, next);
+      next->left = e->left;
+      next->left->parent = next;
+      next->red = e->red;
+    }
+  else
+    {
+      removed_red = e->red;
+      child = e->left != NULL ? e->left : e->right;
+      parent = e->parent;
+      replace_child (t, e, child);
+    }
+
+  t->elem_cnt--;
+  if (!removed_red)
+    delete_fixup (t, child, parent);
+}
+
+/** Returns the least element of T, or a null pointer if T is
+   empty. */
+struct rb_elem *
+rb_min (struct rbtree *t)
+{
+  struct rb_elem *e = t->root;
+
+  if (e != NULL)
+    while (e->left != NULL)
+      e = e->left;
+  return e;
+}
+
+/** Returns the greatest element of T, or a null pointer if T is
+   empty. */
+struct rb_elem *
+rb_max (struct rbtree *t)
+{
+  struct rb_elem *e = t->root;
+
+  if (e != NULL)
+    while (e->right != NULL)
+      e = e->right;
+  return e;
+}
+
+/** Returns the element after E in its tree, or a null pointer if
+   E is the greatest. */
+struct rb_elem *
+rb_next (struct rb_elem *e)
+{
+  if (e->right != NULL)
+    {
+      e = e->right;
+      while (e->left != NULL)
+        e = e->left;
+      return e;
+    }
+
+  while (e->parent != NULL && e->parent->right == e)
+    e = e->parent;
+  return e->parent;
+}
+
+/** Returns the element before E in its tree, or a null pointer
+   if E is the least. */
+struct rb_elem *
+rb_prev (struct rb_elem *e)
+{
+  if (e->left != NULL)
+    {
+      e = e->left;
+      while (e->right != NULL)
+        e = e->right;
+      return e;
+    }
+
+  while (e->parent != NULL && e->parent->left == e)
+    e = e->parent;
+  return e->parent;
+}
+
+/** Returns the number of elements in T. */
+size_t
+rb_size (struct rbtree *t)
+{
+  return t->elem_cnt;
+}
+
+/** Returns true if T contains no elements, false otherwise. */
+bool
+rb_empty (struct rbtree *t)
+{
+  return t->elem_cnt == 0;
+}
+
+/** Returns true if E is a red node.  Missing nodes are black. */
+static bool
+is_red (const struct rb_elem *e)
+{
+  return e != NULL && e->red;
+}
+
+/** Makes NEW take OLD's place under OLD's parent in T.  NEW may
+   be null. */
+static void
+replace_child (struct rbtree *t, struct rb_elem *old, struct rb_elem *new)
+{
+  if (new != NULL)
+    new->parent = old->parent;
+  if (old->parent == NULL)
+    t->root = new;
+  else if (old->parent->left == old)
+    old->parent->left = new;
+  else
+    old->parent->right = new;
+}
+
+/** Rotates E's right child up into E's place. */
+static void
+rotate_left (struct rbtree *t, struct rb_elem *e)
+{
+  struct rb_elem *r = e->right;
+
+  e->right = r->left;
+  if (r->left != NULL)
+    r->left->parent = e;
+  replace_child (t, e, r);
+  r->left = e;
+  e->parent = r;
+}
+
+/** Rotates E's left child up into E's place. */
+static void
+rotate_right (struct rbtree *t, struct rb_elem *e)
+{
+  struct rb_elem *l = e->left;
+
+  e->left = l->right;
+  if (l->right != NULL)
+    l->right->parent = e;
+  replace_child (t, e, l);
+  l->right = e;
+  e->parent = l;
+}
+
+/** Restores the red-black rules after red node E was inserted. */
+static void
+insert_fixup (struct rbtree *t, struct rb_elem *e)
+{
+  while (is_red (e->parent))
+    {
+      struct rb_elem *parent = e->parent;
+      struct rb_elem *grand = parent->parent;
+
+      if (parent == grand->left)
+        {
+          struct rb_elem *uncle = grand->right;
+
+          if (is_red (uncle))
+            {
+              parent->red = uncle->red = false;
+              grand->red = true;
+              e = grand;
+              continue;
+            }
+          if (e == parent->right)
+            {
+              rotate_left (t, parent);
+              e = parent;
+              parent = e->parent;
+            }
+          parent->red = false;
+          grand->red = true;
+          rotate_right (t, grand);
+        }
+      else
+        {
+          struct rb_elem *uncle = grand->left;
+
+          if (is_red (uncle))
+            {
+              parent->red = uncle->red = false;
+              grand->red = true;
+              e = grand;
+              continue;
+            }
+          if (e == parent->left)
+            {
+              rotate_right (t, parent);
+              e = parent;
+              parent = e->parent;
+            }
+          parent->red = false;
+          grand->red = true;
+          rotate_left (t, grand);
+        }
+    }
+  t->root->red = false;
+}
+
+/** Restores the red-black rules after a black node was removed
+   from below PARENT, leaving E (possibly null) in its place one
+   black node short. */
+static void
+delete_fixup (struct rbtree *t, struct rb_elem *e, struct rb_elem *parent)
+{
+  while (e != t->root && !is_red (e))
+    {
+      if (e == parent->left)
+        {
+          struct rb_elem *sib = parent->right;
+
+          if (is_red (sib))
+            {
+              sib->red = false;
+              parent->red = true;
+              rotate_left (t, parent);
+              sib = parent->right;
+            }
+          if (!is_red (sib->left) && !is_red (sib->right))
+            {
+              sib->red = true;
+              e = parent;
+              parent = e->parent;
+              continue;
+            }
+          if (!is_red (sib->right))
+            {
+              sib->left->red = false;
+              sib->red = true;
+              rotate_right (t, sib);
+              sib = parent->right;
+            }
+          sib->red = parent->red;
+          parent->red = false;
+          sib->right->red = false;
+          rotate_left (t, parent);
+        }
+      else
+        {
+          struct rb_elem *sib = parent->left;
+
+          if (is_red (sib))
+            {
+              sib->red = false;
+              parent->red = true;
+              rotate_right (t, parent);
+              sib = parent->left;
+            }
+          if (!is_red (sib->left) && !is_red (sib->right))
+            {
+              sib->red = true;
+              e = parent;
+              parent = e->parent;
+              continue;
+            }
+          if (!is_red (sib->left))
+            {
+              sib->right->red = false;
+              sib->red = true;
+              rotate_left (t, sib);
+              sib = parent->left;
+            }
+          sib->red = parent->red;
+          parent->red = false;
+          sib->left->red = false;
+          rotate_right (t, parent);
+        }
+      e = t->root;
+      break;
+    }
+  if (e != NULL)
+    e->red = false;
+}
@@ -0,0 +1,81 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/** Red-black tree.
+
+   A balanced binary search tree: insertion, deletion and lookup
+   all take O(log n) time, and the elements can be walked in
+   order.  Besides exact lookups, the tree answers "greatest
+   element not above X" and "least element not below X", which
+   is what interval lookups need.
+
+   Like the list and hash table, the tree does no dynamic
+   allocation.  Each structure that can be in a tree embeds a
+   struct rb_elem member, and rb_entry converts a struct rb_elem
+   back into a pointer to the structure that contains it.  Refer
+   to lib/kernel/list.h for a detailed explanation of the
+   technique. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Tree element. */
+struct rb_elem
+  {
+    struct rb_elem *parent;     /**< Parent, or null for the root. */
+    struct rb_elem *left;       /**< Left child. */
+    struct rb_elem *right;      /**< Right child. */
+    bool red;                   /**< Node color. */
+  };
+
+/** Converts pointer to tree element RB_ELEM into a pointer to
+   the structure that RB_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the tree element. */
+#define rb_entry(RB_ELEM, STRUCT, MEMBER)                       \
+        ((STRUCT *) ((uint8_t *) &(RB_ELEM)->parent             \
+                     - offsetof (STRUCT, MEMBER.parent)))
+
+/** Compares the value of two tree elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool rb_less_func (const struct rb_elem *a,
+                           const struct rb_elem *b,
+                           void *aux);
+
+/** Performs some operation on tree element E, given auxiliary
+   data AUX. */
+typedef void rb_action_func (struct rb_elem *e, void *aux);
+
+/** Red-black tree. */
+struct rbtree
+  {
+    struct rb_elem *root;       /**< Root, or null if empty. */
+    size_t elem_cnt;            /**< Number of elements in tree. */
+    rb_less_func *less;         /**< Comparison function. */
+    void *aux;                  /**< Auxiliary data for `less'. */
+  };
+
+/** Basic life cycle. */
+void rb_init (struct rbtree *, rb_less_func *, void *aux);
+void rb_clear (struct rbtree *, rb_action_func *);
+
+/** Search, insertion, deletion. */
+struct rb_elem *rb_insert (struct rbtree *, struct rb_elem *);
+struct rb_elem *rb_find (struct rbtree *, const struct rb_elem *);
+struct rb_elem *rb_floor (struct rbtree *, const struct rb_elem *);
+struct rb_elem *rb_ceil (struct rbtree *, const struct rb_elem *);
+void rb_delete (struct rbtree *, struct rb_elem *);
+
+/** Traversal. */
+struct rb_elem *rb_min (struct rbtree *);
+struct rb_elem *rb_max (struct rbtree *);
+struct rb_elem *rb_next (struct rb_elem *);
+struct rb_elem *rb_prev (struct rb_elem *);
+
+/** Information. */
+size_t rb_size (struct rbtree *);
+bool rb_empty (struct rbtree *);
+
+#endif /**< lib/kernel/rbtree.h */
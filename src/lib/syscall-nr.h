@@ -28,7 +28,12 @@ enum
     SYS_MKDIR,                  /**< Create a directory. */
     SYS_READDIR,                /**< Reads a directory entry. */
     SYS_ISDIR,                  /**< Tests if a fd represents a directory. */
-    SYS_INUMBER                 /**< Returns the inode number for a fd. */
+    SYS_INUMBER,                /**< Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FORK,                   /**< Clone the calling process. */
+    SYS_READV,                  /**< Read from a file into several buffers. */
+    SYS_WRITEV                  /**< Write several buffers to a file. */
   };
 
 #endif /**< lib/syscall-nr.h */
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <iovec.h>
 
 /** Process identifier. */
 typedef int pid_t;
@@ -45,4 +46,9 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/** Extensions. */
+pid_t fork (void);
+int readv (int fd, const struct iovec *, int iovcnt);
+int writev (int fd, const struct iovec *, int iovcnt);
+
 #endif /**< lib/user/syscall.h */
@@ -0,0 +1,105 @@
+/** Writes a file with writev() from several buffers, then reads
+   it back with readv() into several others, checking the data and
+   the file position after each call.  The file is larger than the
+   buffer cache, so reading its start back covers runs of whole
+   sectors that are not cached and are read straight into the
+   caller's buffer. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (160 * 512)
+
+static char buf[FILE_SIZE];
+static char out[FILE_SIZE];
+
+static void
+check_tell (int fd, long ofs) 
+{
+  long pos = tell (fd);
+  if (pos != ofs)
+    fail ("file position not updated properly: should be %ld, actually %ld",
+          ofs, pos);
+}
+
+void
+test_main (void) 
+{
+  struct iovec iov[4];
+  int fd, n;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create ("vec", 0), "create \"vec\"");
+  CHECK ((fd = open ("vec")) > 1, "open \"vec\"");
+
+  /* Gather from buffers that start and end inside sectors. */
+  msg ("writev \"vec\"");
+  iov[0].iov_base = buf;
+  iov[0].iov_len = 37;
+  iov[1].iov_base = buf + 37;
+  iov[1].iov_len = 1000;
+  iov[2].iov_base = buf + 1037;
+  iov[2].iov_len = FILE_SIZE - 1037;
+  n = writev (fd, iov, 3);
+  if (n != FILE_SIZE)
+    fail ("writev returned %d instead of %d", n, FILE_SIZE);
+  check_tell (fd, FILE_SIZE);
+  msg ("close \"vec\"");
+  close (fd);
+
+  /* Scatter the whole file: a sector-aligned buffer of 16 whole
+     sectors, a piece of a sector, and the rest, which starts
+     inside a sector. */
+  CHECK ((fd = open ("vec")) > 1, "open \"vec\" for verification");
+  msg ("readv \"vec\"");
+  iov[0].iov_base = out;
+  iov[0].iov_len = 16 * 512;
+  iov[1].iov_base = out + 16 * 512;
+  iov[1].iov_len = 100;
+  iov[2].iov_base = out + 16 * 512 + 100;
+  iov[2].iov_len = 1;
+  iov[3].iov_base = out + 16 * 512 + 101;
+  iov[3].iov_len = FILE_SIZE - (16 * 512 + 101);
+  n = readv (fd, iov, 4);
+  if (n != FILE_SIZE)
+    fail ("readv returned %d instead of %d", n, FILE_SIZE);
+  check_tell (fd, FILE_SIZE);
+  compare_bytes (out, buf, FILE_SIZE, 0, "vec");
+
+  /* Scatter from the middle of the file. */
+  msg ("readv \"vec\" at offset %d", 20 * 512);
+  memset (out, 0, sizeof out);
+  seek (fd, 20 * 512);
+  iov[0].iov_base = out;
+  iov[0].iov_len = 8 * 512;
+  iov[1].iov_base = out + 8 * 512;
+  iov[1].iov_len = 50;
+  n = readv (fd, iov, 2);
+  if (n != 8 * 512 + 50)
+    fail ("readv returned %d instead of %d", n, 8 * 512 + 50);
+  check_tell (fd, 20 * 512 + 8 * 512 + 50);
+  compare_bytes (out, buf + 20 * 512, 8 * 512 + 50, 20 * 512, "vec");
+
+  /* Scatter across the end of the file: only what is there is
+     read, and the position stops at the end. */
+  msg ("readv \"vec\" at offset %d", FILE_SIZE - 300);
+  memset (out, 0, sizeof out);
+  seek (fd, FILE_SIZE - 300);
+  iov[0].iov_base = out;
+  iov[0].iov_len = 200;
+  iov[1].iov_base = out + 200;
+  iov[1].iov_len = 200;
+  n = readv (fd, iov, 2);
+  if (n != 300)
+    fail ("readv returned %d instead of %d", n, 300);
+  check_tell (fd, FILE_SIZE);
+  compare_bytes (out, buf + FILE_SIZE - 300, 300, FILE_SIZE - 300, "vec");
+  if (out[300] != 0)
+    fail ("readv wrote past the end of the file's data");
+
+  msg ("close \"vec\"");
+  close (fd);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(vec-rw) begin
+(vec-rw) create "vec"
+(vec-rw) open "vec"
+(vec-rw) writev "vec"
+(vec-rw) close "vec"
+(vec-rw) open "vec" for verification
+(vec-rw) readv "vec"
+(vec-rw) readv "vec" at offset 10240
+(vec-rw) readv "vec" at offset 81620
+(vec-rw) close "vec"
+(vec-rw) end
+EOF
+pass;
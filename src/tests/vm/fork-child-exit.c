@@ -0,0 +1,45 @@
+/** Forks a child that writes part of the memory it shares with its
+   parent and exits while the rest is still shared copy-on-write,
+   then checks that the parent can still read and write all of it. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+static unsigned char buf[SIZE];
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  msg ("initialize");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+
+  child = fork ();
+  if (child == 0)
+    {
+      /* Unshare the first half, leave the second shared. */
+      for (i = 0; i < SIZE / 2; i++)
+        buf[i] = 0;
+      exit (0);
+    }
+  CHECK (child != PID_ERROR, "fork");
+  CHECK (wait (child) == 0, "wait for child");
+
+  msg ("read pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != i % 251)
+      fail ("byte %zu is %d, not %d", i, buf[i], (int) (i % 251));
+
+  msg ("write pass");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = 250 - i % 251;
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 250 - i % 251)
+      fail ("byte %zu is %d, not %d", i, buf[i], (int) (250 - i % 251));
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-child-exit) begin
+(fork-child-exit) initialize
+(fork-child-exit) fork
+(fork-child-exit) wait for child
+(fork-child-exit) read pass
+(fork-child-exit) write pass
+(fork-child-exit) end
+EOF
+pass;
@@ -0,0 +1,49 @@
+/** Forks, then has the parent and the child write different values
+   over the same pages, and checks that neither process sees the
+   other's writes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+static char buf[SIZE];
+
+/* Fails unless every byte of BUF is VALUE. */
+static void
+check_buf (char value, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != value)
+      fail ("%s: byte %zu is %02hhx, not %02hhx", who, i, buf[i], value);
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+
+  msg ("initialize");
+  memset (buf, 0x5a, sizeof buf);
+
+  child = fork ();
+  if (child == 0)
+    {
+      /* The child sees memory as it was at the fork, whatever the
+         parent has written since. */
+      check_buf (0x5a, "child");
+      memset (buf, 0xc3, sizeof buf);
+      check_buf (0xc3, "child");
+      exit (81);
+    }
+  CHECK (child != PID_ERROR, "fork");
+
+  memset (buf, 0x3c, sizeof buf);
+  CHECK (wait (child) == 81, "wait for child");
+  check_buf (0x3c, "parent");
+  msg ("parent's pages intact");
+}
@@ -0,0 +1,62 @@
+/** Fills more memory than fits in RAM, so that much of it is in
+   swap, then forks.  Checks that the child sees all of it and that
+   the child's writes do not reach the parent. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+#define PAGE 4096
+
+static unsigned char buf[SIZE];
+
+/* Byte I of the pattern. */
+static unsigned char
+value (size_t i)
+{
+  return i * 31 + i / PAGE;
+}
+
+/* Fails unless BUF holds the pattern, except for the first byte of
+   every other page if CHANGED. */
+static void
+check_buf (bool changed, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    {
+      unsigned char expected = value (i);
+      if (changed && i % (2 * PAGE) == 0)
+        expected = ~expected;
+      if (buf[i] != expected)
+        fail ("%s: byte %zu is %d, not %d", who, i, buf[i], expected);
+    }
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  msg ("initialize");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = value (i);
+
+  child = fork ();
+  if (child == 0)
+    {
+      check_buf (false, "child");
+      for (i = 0; i < SIZE; i += 2 * PAGE)
+        buf[i] = ~value (i);
+      check_buf (true, "child");
+      exit (42);
+    }
+  CHECK (child != PID_ERROR, "fork");
+  CHECK (wait (child) == 42, "wait for child");
+
+  msg ("read pass");
+  check_buf (false, "parent");
+}
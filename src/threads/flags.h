@@ -4,5 +4,12 @@
 /** EFLAGS Register. */
 #define FLAG_MBS  0x00000002    /**< Must be set. */
 #define FLAG_IF   0x00000200    /**< Interrupt Flag. */
+#define FLAG_ID   0x00200000    /**< Toggleable if CPUID exists. */
+
+/** CR4 Register. */
+#define CR4_PGE   0x00000080    /**< Page Global Enable. */
+
+/** CPUID leaf 1, EDX. */
+#define CPUID_PGE 0x00002000    /**< Page Global Enable supported. */
 
 #endif /**< threads/flags.h */
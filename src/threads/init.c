@@ -15,6 +15,7 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -31,11 +32,20 @@
 #else
 #include "tests/threads/tests.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/ksm.h"
+#include "vm/page.h"
+#include "vm/pagecache.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
+#endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
 #endif
 
 /** Page directory with kernel mappings only. */
@@ -59,6 +69,7 @@ static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init (void);
 static void paging_init (void);
+static bool cpu_has_pge (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -130,6 +141,10 @@ pintos_init (void)
 #ifdef VM
   locate_block_devices ();
   swap_to_pageit ();
+  vm_frame_init ();
+  vm_page_init ();
+  pagecache_init ();
+  ksm_init ();
 #endif
 
   printf ("Boot complete.\n");
@@ -169,6 +184,7 @@ paging_init (void)
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  bool pge = cpu_has_pge ();
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -186,7 +202,11 @@ paging_init (void)
           pd[pde_idx] = pde_create (pt);
         }
 
+      /* The kernel mapping is the same in every page directory,
+         so it can be global, if the CPU has global pages. */
       pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      if (pge)
+        pt[pte_idx] |= PTE_G;
     }
 
   /* Store the physical address of the page directory into CR3
@@ -195,6 +215,35 @@ paging_init (void)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  /* Turn on global pages, so that switching page directories
+     leaves the kernel's TLB entries alone.  See [IA32-v3a] 3.12
+     "Translation Lookaside Buffers (TLBs)". */
+  if (pge)
+    asm volatile ("movl %%cr4, %%eax; orl %0, %%eax; movl %%eax, %%cr4"
+                  : : "i" (CR4_PGE) : "eax");
+}
+
+/** Returns true if the CPU supports global pages.  Setting CR4.PGE
+   on a CPU without them raises #GP.  CPUID exists if the ID flag
+   in EFLAGS can be toggled.  See [IA32-v2a] "CPUID--CPU
+   Identification". */
+static bool
+cpu_has_pge (void)
+{
+  uint32_t before, after, max, eax, edx;
+
+  asm volatile ("pushfl; popl %0; movl %0, %1; xorl %2, %1; "
+                "pushl %1; popfl; pushfl; popl %1; pushl %0; popfl"
+                : "=&r" (before), "=&r" (after) : "i" (FLAG_ID));
+  if (((before ^ after) & FLAG_ID) == 0)
+    return false;
+
+  asm volatile ("cpuid" : "=a" (max) : "0" (0) : "ebx", "ecx", "edx");
+  if (max < 1)
+    return false;
+  asm volatile ("cpuid" : "=a" (eax), "=d" (edx) : "0" (1) : "ebx", "ecx");
+  return (edx & CPUID_PGE) != 0;
 }
 
 /** Breaks the kernel command line into words and returns them as
@@ -256,6 +305,8 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-icache"))
+        inode_cache_size = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -268,6 +319,14 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-fault-around"))
+        fault_around_max = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        zswap_pool_pages = atoi (value);
+      else if (!strcmp (name, "-ksm"))
+        ksm_pages_to_scan = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -382,6 +441,7 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -icache=N          Keep up to N closed inodes in memory.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -390,6 +450,11 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -fault-around=N    Map up to N pages around file page faults.\n"
+          "  -zswap=PAGES       Use PAGES of user memory for compressed swap.\n"
+          "  -ksm=PAGES         Merge identical pages, scanning PAGES per pass.\n"
 #endif
           );
   shutdown_power_off ();
@@ -9,6 +9,12 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "devices/timer.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 /** Programmable Interrupt Controller (PIC) registers.
    A PC has two PICs, called the master and slave PICs, with the
@@ -386,6 +392,20 @@ intr_handler (struct intr_frame *frame)
       if (yield_on_return) 
         thread_yield (); 
     }
+
+#ifdef VM
+  /* About to return to user mode, with no locks held and no fault or
+     system call in progress: the only safe place for a process that
+     load control has suspended to sleep.  Catching every interrupt,
+     timer ticks included, stops a process that neither faults nor
+     makes system calls within a tick. */
+  if (frame->cs == SEL_UCSEG)
+    {
+      enum intr_level old_level = intr_enable ();
+      vm_frame_load_control ();
+      intr_set_level (old_level);
+    }
+#endif
 }
 
 /** Handles an unexpected interrupt with interrupt frame F.  An
@@ -443,6 +443,89 @@ cond_broadcast (struct condition *cond, struct lock *lock)
     cond_signal (cond, lock);
 }
 
+/** Initializes readers-writer lock RWLOCK.  Any number of readers
+   may hold it at once, or one writer alone.  Waiting writers block
+   new readers, so a steady stream of readers cannot starve a
+   writer. */
+void
+rwlock_init (struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  cond_init (&rwlock->readers);
+  cond_init (&rwlock->writers);
+  rwlock->active_readers = 0;
+  rwlock->waiting_writers = 0;
+  rwlock->writer = NULL;
+}
+
+/** Acquires RWLOCK for reading, sleeping until no writer holds or
+   waits for it. */
+void
+rwlock_acquire_read (struct rwlock *rwlock) 
+{
+  ASSERT (!intr_context ());
+  ASSERT (rwlock->writer != thread_current ());
+
+  lock_acquire (&rwlock->lock);
+  while (rwlock->writer != NULL || rwlock->waiting_writers > 0)
+    cond_wait (&rwlock->readers, &rwlock->lock);
+  rwlock->active_readers++;
+  lock_release (&rwlock->lock);
+}
+
+/** Releases RWLOCK, which the current thread holds for reading. */
+void
+rwlock_release_read (struct rwlock *rwlock) 
+{
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->active_readers > 0);
+  if (--rwlock->active_readers == 0)
+    cond_signal (&rwlock->writers, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/** Acquires RWLOCK for writing, sleeping until no reader or other
+   writer holds it. */
+void
+rwlock_acquire_write (struct rwlock *rwlock) 
+{
+  ASSERT (!intr_context ());
+  ASSERT (rwlock->writer != thread_current ());
+
+  lock_acquire (&rwlock->lock);
+  rwlock->waiting_writers++;
+  while (rwlock->writer != NULL || rwlock->active_readers > 0)
+    cond_wait (&rwlock->writers, &rwlock->lock);
+  rwlock->waiting_writers--;
+  rwlock->writer = thread_current ();
+  lock_release (&rwlock->lock);
+}
+
+/** Releases RWLOCK, which the current thread holds for writing.
+   Hands it to the next writer if there is one, else to every
+   waiting reader. */
+void
+rwlock_release_write (struct rwlock *rwlock) 
+{
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->writer == thread_current ());
+  rwlock->writer = NULL;
+  if (rwlock->waiting_writers > 0)
+    cond_signal (&rwlock->writers, &rwlock->lock);
+  else
+    cond_broadcast (&rwlock->readers, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/** Returns true if the current thread holds RWLOCK for writing. */
+bool
+rwlock_held_for_write (const struct rwlock *rwlock) 
+{
+  return rwlock->writer == thread_current ();
+}
+
 /** Compares priority of semaphores, returning true if the first one is greater.*/
 bool
 semaphore_priority_great(const struct list_elem* a, const struct list_elem *b, void* aux UNUSED)
@@ -43,6 +43,24 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/** Readers-writer lock. */
+struct rwlock 
+  {
+    struct lock lock;           /**< Protects the fields below. */
+    struct condition readers;   /**< Signaled when readers may enter. */
+    struct condition writers;   /**< Signaled when a writer may enter. */
+    unsigned active_readers;    /**< Readers holding the lock. */
+    unsigned waiting_writers;   /**< Writers waiting for the lock. */
+    struct thread *writer;      /**< Writer holding the lock, if any. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
 bool semaphore_priority_great(const struct list_elem* a, const struct list_elem *b, void* aux UNUSED);
 
 /** Optimization barrier.
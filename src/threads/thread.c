@@ -349,6 +349,31 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
+/** Returns the thread whose tid is TID, or a null pointer if there
+   is none, for example because it has exited. */
+struct thread *
+thread_get_by_id (tid_t tid)
+{
+  struct thread *found = NULL;
+  struct list_elem *e;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  for (e = list_begin (&all_list); e != list_end (&all_list);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, allelem);
+      if (t->tid == tid)
+        {
+          found = t;
+          break;
+        }
+    }
+  intr_set_level (old_level);
+
+  return found;
+}
+
 /** Sets the current thread's priority to NEW_PRIORITY. */
 void
 thread_set_priority(int new_priority) {
@@ -524,6 +549,9 @@ init_thread (struct thread *t, const char *name, int priority)
   #ifdef USERPROG
     /* init the mapid allocator, which indicate the next mapid */
     t->mapid_allocator = 0;
+    list_init (&t->children);
+    t->exit_record = NULL;
+    t->exit_status = -1;
   #endif
   list_push_back (&all_list, &t->allelem);
   intr_set_level (old_level);
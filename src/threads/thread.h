@@ -4,6 +4,7 @@
 #include "threads/fixed_point.h"
 #include <debug.h>
 #include <list.h>
+#include <rbtree.h>
 #include <stdint.h>
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
@@ -109,8 +110,33 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /**< Page directory. */
-    /* supplemental page table, which stores as hash table */
+    struct list children;               /**< Statuses of forked children. */
+    struct child_status *exit_record;   /**< Parent's record of us, or null. */
+    int exit_status;                    /**< Status given to exit(). */
+    /* supplemental page table of swapped pages, stored as hash table */
     struct hash suppl_page_table;
+    struct rbtree vmas;                 /**< Virtual memory areas, by address. */
+    /* swap readahead and clustering state, owned by vm/ */
+    int swap_ra_window;                 /**< Neighbours read on swap-in. */
+    unsigned swap_ra_hits;              /**< Readahead pages later used. */
+    unsigned swap_ra_misses;            /**< Readahead pages evicted unused. */
+    size_t swap_last_slot;              /**< Last swap slot written. */
+    struct list shared_maps;            /**< Mappings of page cache frames. */
+    /* working set and frame allotment, owned by vm/frame.c */
+    size_t frame_cnt;                   /**< Frames currently owned. */
+    size_t swapped_cnt;                 /**< Pages only in swap. */
+    size_t frame_quota;                 /**< Frames allotted by PFF. */
+    int64_t last_fault;                 /**< Timer tick of the last fault. */
+    bool suspended;                     /**< Suspended by load control? */
+    bool oom_killed;                    /**< Picked by the OOM killer? */
+    int64_t suspended_at;               /**< Timer tick of the suspension. */
+    struct list_elem vm_elem;           /**< Element in frame.c's process list. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /**< Nesting of open journal handles. */
+    int journal_cnt;                    /**< Sectors its handle added. */
 #endif
 
     /* Owned by thread.c. */
@@ -135,6 +161,7 @@ void thread_block (void);
 void thread_unblock (struct thread *);
 
 struct thread *thread_current (void);
+struct thread *thread_get_by_id (tid_t);
 tid_t thread_tid (void);
 const char *thread_name (void);
 
@@ -6,6 +6,7 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
+#include "vm/frame.h"
 #include "vm/page.h"
 
 /** Number of page faults processed. */
@@ -128,6 +129,7 @@ page_fault (struct intr_frame *f)
   bool user;         /* True if accessed by user mode. */
   void *fault_addr;  /* Address that caused the fault. */
   struct suppl_pte *spte;  /* Supplemental page table entry. */
+  struct vm_area *vma;     /* Area containing the fault. */
   struct thread *cur = thread_current (); /* Current thread. */
 
   /* Fetch faulting address from CR2. */
@@ -142,23 +144,41 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* Handle write violations. */
+  /* Handle write violations.  Writes to copy-on-write pages get a
+     private copy of the page; anything else is fatal. */
   if (!not_present)
-    exit (-1);
+    {
+      if (write && is_user_vaddr (fault_addr) && vm_page_cow (fault_addr))
+        return;
+      exit (-1);
+    }
   
   /* Ensure valid address and user-space access. */
   if (fault_addr == NULL || !not_present || !is_user_vaddr(fault_addr))
     exit (-1);
 
-  /* Lookup the supplemental page table entry. */
+  /* Let the fault rate steer the process's frame allotment.  A
+     process the OOM killer picked dies here. */
+  if (!vm_frame_pff_fault ())
+    exit (-1);
+
+  /* Lookup the supplemental page table entry, which only swapped
+     pages have, and the area the page belongs to. */
   spte = get_suppl_pte (&cur->suppl_page_table, pg_round_down(fault_addr));
+  vma = vma_find (cur, fault_addr);
 
   if (spte != NULL && !spte->is_loaded) {
-    load_page (spte);
+    if (!load_page (spte))
+      exit (-1);
   } 
+  else if (spte == NULL && vma != NULL) {
+    if (!load_page_vma (vma, pg_round_down (fault_addr), write))
+      exit (-1);
+  }
   else if (spte == NULL && fault_addr >= (f->esp - 32) &&
            (PHYS_BASE - pg_round_down (fault_addr)) <= STACK_SIZE) {
-    grow_stack (fault_addr);
+    if (!grow_stack (fault_addr, write))
+      exit (-1);
   } 
   else {
     if (!pagedir_get_page (cur->pagedir, fault_addr))
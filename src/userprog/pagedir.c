@@ -8,6 +8,8 @@
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *,
+                             struct pagedir_batch *);
 
 /** Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -40,7 +42,7 @@ pagedir_destroy (uint32_t *pd)
         uint32_t *pte;
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P) 
+          if ((*pte & PTE_P) && !(*pte & PTE_COW)) 
             palloc_free_page (pte_get_page (*pte));
         palloc_free_page (pt);
       }
@@ -118,6 +120,69 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     return false;
 }
 
+/** Adds a read-only, copy-on-write mapping in page directory PD
+   from user virtual page UPAGE to the frame at KPAGE.
+   The frame is not owned by PD: pagedir_destroy() does not free
+   it, and a write to UPAGE faults so that the page can be copied.
+   Returns true if successful, false if memory allocation
+   failed. */
+bool
+pagedir_set_page_cow (uint32_t *pd, void *upage, void *kpage)
+{
+  if (!pagedir_set_page (pd, upage, kpage, false))
+    return false;
+  *lookup_page (pd, upage, false) |= PTE_COW;
+  return true;
+}
+
+/** Returns true if user virtual page UPAGE is present in PD with a
+   copy-on-write mapping. */
+bool
+pagedir_is_cow (uint32_t *pd, const void *upage) 
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+  return pte != NULL && (*pte & PTE_P) != 0 && (*pte & PTE_COW) != 0;
+}
+
+/** Makes the present mapping of user virtual page UPAGE in PD
+   read-only and copy-on-write, so that the next write to it
+   faults.  Used to share a process's frames with its child. */
+void
+pagedir_share_cow (uint32_t *pd, void *upage)
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+
+  ASSERT (pte != NULL && (*pte & PTE_P) != 0);
+  *pte = (*pte & ~(uint32_t) PTE_W) | PTE_COW;
+  invalidate_page (pd, upage, NULL);
+}
+
+/** Makes the copy-on-write mapping of user virtual page UPAGE in
+   PD writable again, once PD is the frame's only user. */
+void
+pagedir_unshare_cow (uint32_t *pd, void *upage)
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+
+  ASSERT (pte != NULL && (*pte & PTE_P) != 0);
+  *pte = (*pte & ~(uint32_t) PTE_COW) | PTE_W;
+  invalidate_page (pd, upage, NULL);
+}
+
+/** Points the copy-on-write mapping of user virtual page UPAGE in
+   PD at the frame at KPAGE, which must hold the same data, keeping
+   the other bits of the mapping.  Used to merge identical pages. */
+void
+pagedir_move_cow (uint32_t *pd, void *upage, void *kpage)
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+
+  ASSERT (pg_ofs (kpage) == 0);
+  ASSERT (pte != NULL && (*pte & PTE_P) != 0 && (*pte & PTE_COW) != 0);
+  *pte = vtop (kpage) | (*pte & PTE_FLAGS);
+  invalidate_page (pd, upage, NULL);
+}
+
 /** Looks up the physical address that corresponds to user virtual
    address UADDR in PD.  Returns the kernel virtual address
    corresponding to that physical address, or a null pointer if
@@ -136,6 +201,16 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
     return NULL;
 }
 
+/** Returns the page table entry for user virtual page UPAGE in
+   PD, or a null pointer if PD has no page table covering UPAGE.
+   The entry is returned whether or not it is present. */
+uint32_t *
+pagedir_get_pte (uint32_t *pd, const void *upage) 
+{
+  ASSERT (is_user_vaddr (upage));
+  return lookup_page (pd, upage, false);
+}
+
 /** Marks user virtual page UPAGE "not present" in page
    directory PD.  Later accesses to the page will fault.  Other
    bits in the page table entry are preserved.
@@ -152,7 +227,7 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage, NULL);
     }
 }
 
@@ -180,7 +255,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage, NULL);
         }
     }
 }
@@ -209,18 +284,67 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage, NULL);
         }
     }
 }
 
+/** Returns whether the PTE for virtual page VPAGE in PD has been
+   accessed, and clears its accessed bit.  The TLB invalidation
+   this needs is added to BATCH, to be done by
+   pagedir_batch_flush(), or done at once if BATCH is null. */
+bool
+pagedir_test_and_clear_accessed (uint32_t *pd, const void *vpage,
+                                 struct pagedir_batch *batch)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+
+  if (pte == NULL || (*pte & PTE_A) == 0)
+    return false;
+  *pte &= ~(uint32_t) PTE_A;
+  invalidate_page (pd, vpage, batch);
+  return true;
+}
+
+/** Initializes BATCH to collect TLB invalidations. */
+void
+pagedir_batch_init (struct pagedir_batch *batch)
+{
+  batch->pd = NULL;
+  batch->page_cnt = 0;
+}
+
+/** Does the TLB invalidations collected in BATCH: one invlpg per
+   page, or a single reload of the page directory if more pages
+   were collected than BATCH holds. */
+void
+pagedir_batch_flush (struct pagedir_batch *batch)
+{
+  size_t i;
+
+  if (batch->pd == NULL)
+    return;
+
+  if (batch->page_cnt > PAGEDIR_BATCH_PAGES)
+    invalidate_pagedir (batch->pd);
+  else if (active_pd () == batch->pd)
+    for (i = 0; i < batch->page_cnt; i++)
+      asm volatile ("invlpg (%0)" : : "r" (batch->pages[i]) : "memory");
+
+  pagedir_batch_init (batch);
+}
+
 /** Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is already loaded: switching between
+   threads that share a page directory, kernel threads above all,
+   then keeps the TLB. */
 void
 pagedir_activate (uint32_t *pd) 
 {
   if (pd == NULL)
     pd = init_page_dir;
+  if (active_pd () == pd)
+    return;
 
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
@@ -243,21 +367,52 @@ active_pd (void)
   return ptov (pd);
 }
 
+/** Invalidates the TLB entry for virtual page VPAGE in PD, if PD
+   is the active page directory, or adds it to BATCH if BATCH is
+   not null.  (If PD is not active then its entries are not in
+   the TLB, so there is no need to invalidate anything.) */
+static void
+invalidate_page (uint32_t *pd, const void *vpage,
+                 struct pagedir_batch *batch)
+{
+  if (active_pd () != pd)
+    return;
+
+  if (batch == NULL)
+    {
+      /* Drop the single entry.  See [IA32-v3a] 3.12 "Translation
+         Lookaside Buffers (TLBs)". */
+      asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
+      return;
+    }
+
+  /* Only the active page directory needs flushing, so a batch
+     collects pages of one directory. */
+  ASSERT (batch->pd == NULL || batch->pd == pd);
+  batch->pd = pd;
+  if (batch->page_cnt < PAGEDIR_BATCH_PAGES)
+    batch->pages[batch->page_cnt] = vpage;
+  if (batch->page_cnt <= PAGEDIR_BATCH_PAGES)
+    batch->page_cnt++;
+}
+
 /** Seom page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
    table.  When this happens, we have to "invalidate" the TLB by
    re-activating it.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
+   This function invalidates the whole TLB if PD is the active
+   page directory; invalidate_page() is cheaper when only a few
+   entries changed.  (If PD is not active then its entries are not in
    the TLB, so there is no need to invalidate anything.) */
 static void
 invalidate_pagedir (uint32_t *pd) 
 {
   if (active_pd () == pd) 
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
+      /* Reloading CR3 clears the TLB, except for the global
+         kernel mappings, which never change.  See [IA32-v3a] 3.12
          "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
     } 
 }
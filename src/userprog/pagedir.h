@@ -2,17 +2,42 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/** Pages a batch of TLB invalidations holds before it falls back
+   to flushing the whole TLB. */
+#define PAGEDIR_BATCH_PAGES 32
+
+/** TLB invalidations collected while changing many PTEs of the
+   active page directory, so that they can be done at once. */
+struct pagedir_batch
+  {
+    uint32_t *pd;               /**< Page directory, if any pages. */
+    size_t page_cnt;            /**< Pages collected, capped at one past
+                                     PAGEDIR_BATCH_PAGES. */
+    const void *pages[PAGEDIR_BATCH_PAGES]; /**< Pages to invalidate. */
+  };
+
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
+bool pagedir_set_page_cow (uint32_t *pd, void *upage, void *kpage);
+bool pagedir_is_cow (uint32_t *pd, const void *upage);
+void pagedir_share_cow (uint32_t *pd, void *upage);
+void pagedir_unshare_cow (uint32_t *pd, void *upage);
+void pagedir_move_cow (uint32_t *pd, void *upage, void *kpage);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
+uint32_t *pagedir_get_pte (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
+bool pagedir_test_and_clear_accessed (uint32_t *pd, const void *upage,
+                                      struct pagedir_batch *);
+void pagedir_batch_init (struct pagedir_batch *);
+void pagedir_batch_flush (struct pagedir_batch *);
 void pagedir_activate (uint32_t *pd);
 
 #endif /**< userprog/pagedir.h */
@@ -16,15 +16,31 @@
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "devices/timer.h"
 #include "userprog/syscall.h"
 #include "vm/frame.h"
 #include "vm/page.h"
+#include "vm/swap.h"
+#include "vm/pagecache.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
+static void init_address_space (struct thread *);
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static void release_status (struct child_status *);
+
+/** What fork() hands to the child it creates. */
+struct fork_args
+  {
+    struct thread *parent;      /**< Forking process. */
+    struct intr_frame if_;      /**< Parent's registers at the system call. */
+    struct child_status *status;/**< Where the child leaves its exit status. */
+    struct semaphore done;      /**< Upped once the child is set up. */
+    bool success;               /**< Did the child get its copy? */
+  };
 
 
 /** Starts a new thread running a user program loaded from
@@ -65,8 +81,7 @@ start_process (void *file_name_)
   bool success;
   struct thread *cur = thread_current ();
 
-  /* init supplemental hash page table */
-  hash_init (&cur->suppl_page_table, suppl_pt_hash, suppl_pt_less, NULL);
+  init_address_space (cur);
 
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
@@ -90,21 +105,139 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/** Sets up the empty address space of new process T. */
+static void
+init_address_space (struct thread *t)
+{
+  /* init supplemental hash page table */
+  hash_init (&t->suppl_page_table, suppl_pt_hash, suppl_pt_less, NULL);
+  vma_init (t);
+  t->swap_ra_window = SWAP_RA_MIN;
+  t->swap_last_slot = SWAP_ERROR;
+  list_init (&t->shared_maps);
+  vm_frame_process_init (t);
+}
+
+/** Starts a child of the current process that returns from the
+   system call interrupted in F as well, with 0 where the parent gets
+   the child's thread id.  The child has the parent's memory, shared
+   copy-on-write, and its own handles on the parent's open files.
+   Returns the child's thread id, or TID_ERROR if the thread cannot
+   be created or the copy runs out of memory. */
+tid_t
+process_fork (struct intr_frame *f)
+{
+  struct thread *cur = thread_current ();
+  struct child_status *cs;
+  struct fork_args args;
+  tid_t tid;
+
+  cs = malloc (sizeof *cs);
+  if (cs == NULL)
+    return TID_ERROR;
+  cs->exit_status = -1;
+  sema_init (&cs->dead, 0);
+  cs->ref_cnt = 2;
+
+  args.parent = cur;
+  args.if_ = *f;
+  args.status = cs;
+  sema_init (&args.done, 0);
+  args.success = false;
+
+  tid = thread_create (cur->name, cur->priority, start_fork, &args);
+  if (tid == TID_ERROR)
+    {
+      free (cs);
+      return TID_ERROR;
+    }
+
+  /* The parent must not touch its memory while the child copies it. */
+  sema_down (&args.done);
+  if (!args.success)
+    {
+      release_status (cs);
+      return TID_ERROR;
+    }
+  cs->tid = tid;
+  list_push_back (&cur->children, &cs->elem);
+  return tid;
+}
+
+/** A thread function that copies the forking process into a new
+   one and starts it running. */
+static void
+start_fork (void *args_)
+{
+  struct fork_args *args = args_;
+  struct thread *cur = thread_current ();
+  struct intr_frame if_ = args->if_;
+  bool success;
+
+  cur->exit_record = args->status;
+  init_address_space (cur);
+  cur->pagedir = pagedir_create ();
+  success = cur->pagedir != NULL
+            && vma_fork (args->parent, cur)
+            && vm_frame_fork (args->parent, cur)
+            && syscall_fork_files (args->parent->tid, cur->tid);
+  process_activate ();
+
+  /* ARGS lives on the parent's stack, gone once the parent runs. */
+  args->success = success;
+  sema_up (&args->done);
+  if (!success)
+    thread_exit ();
+
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
 /** Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait (tid_t child_tid) 
 {
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  /* Only the parent touches its CHILDREN list. */
+  for (e = list_begin (&cur->children); e != list_end (&cur->children);
+       e = list_next (e))
+    {
+      struct child_status *cs = list_entry (e, struct child_status, elem);
+      if (cs->tid == child_tid)
+        {
+          int status;
+
+          list_remove (e);
+          sema_down (&cs->dead);
+          status = cs->exit_status;
+          release_status (cs);
+          return status;
+        }
+    }
   return -1;
 }
 
+/** Drops one of the two references to CS, freeing it with the
+   last. */
+static void
+release_status (struct child_status *cs)
+{
+  enum intr_level old_level = intr_disable ();
+  bool last = --cs->ref_cnt == 0;
+  intr_set_level (old_level);
+
+  if (last)
+    free (cs);
+}
+
 /** Free the current process's resources. */
 void
 process_exit (void)
@@ -115,6 +248,12 @@ process_exit (void)
   /* unmap all the memory mapped files*/
   free_mmfiles (&cur->mmfiles);
 
+  /* Unmap the frames shared with other processes running the same
+     executable, so destroying the page directory leaves them alone. */
+  if (cur->pagedir != NULL)
+    pagecache_drop_process (cur);
+  vm_frame_process_exit (cur);
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -136,6 +275,20 @@ process_exit (void)
 
   /* free the supplemental page table */
   free_suppl_pt (&cur->suppl_page_table);  
+  vma_destroy_all (cur);
+
+  /* Tell the parent how we exited, and let go of the children
+     nobody will wait for now. */
+  if (cur->exit_record != NULL)
+    {
+      cur->exit_record->exit_status = cur->exit_status;
+      sema_up (&cur->exit_record->dead);
+      release_status (cur->exit_record);
+      cur->exit_record = NULL;
+    }
+  while (!list_empty (&cur->children))
+    release_status (list_entry (list_pop_front (&cur->children),
+                                struct child_status, elem));
 
 }
 
@@ -390,9 +543,9 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
 
 /**  
    Lazily loads a segment into the user process's virtual address space by using  
-   demand paging. Instead of immediately reading data into physical memory, entries  
-   are added to the supplemental page table, enabling pages to be loaded only when accessed.  
-   This implementation improves efficiency by avoiding unnecessary memory usage until a page is needed.
+   demand paging. Instead of immediately reading data into physical memory, the
+   segment is recorded as one virtual memory area, enabling pages to be loaded only
+   when accessed.  This takes the same time however large the segment is.
 */
 static bool
 load_segment_lazy (struct file *file, off_t ofs, uint8_t *upage,
@@ -402,24 +555,8 @@ load_segment_lazy (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  while (read_bytes > 0 || zero_bytes > 0) 
-    {
-      /* Determine how many bytes to read from file and how many to zero out. */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      /* Add a supplemental page table entry mapping to demand-load this memory. */
-      if (!suppl_pt_insert_file (file, ofs, upage, page_read_bytes,
-                                 page_zero_bytes, writable))
-	return false;
-
-      /* Advance counters and pointers for the next page. */
-      read_bytes -= page_read_bytes;
-      zero_bytes -= page_zero_bytes;
-      ofs += page_read_bytes;
-      upage += PGSIZE;
-    }
-  return true;
+  return vma_create_file (thread_current (), VMA_FILE, file, ofs, upage,
+                          read_bytes, zero_bytes, writable) != NULL;
 }
 
 /** Sets up the initial stack for a new user process by creating a minimal stack
@@ -431,6 +568,7 @@ static bool
 setup_stack (void **esp, const char *file_name)
 {
   uint8_t *kpage;
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
   bool success = false;
 
   // Allocate a zeroed user page at the top of virtual memory for the stack.
@@ -438,9 +576,15 @@ setup_stack (void **esp, const char *file_name)
   if (kpage != NULL)
     {
       // Map allocated page to the user stack space.
-      success = install_page(((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
+      success = install_page(upage, kpage, true)
+                && vma_create_anon (thread_current (), VMA_STACK, upage,
+                                    PGSIZE) != NULL;
       if (success) 
       {
+        // Let eviction and fork() find the page the frame holds.
+        vm_frame_set_usr (kpage,
+                          pagedir_get_pte (thread_current ()->pagedir, upage),
+                          upage);
         *esp = PHYS_BASE; // Set initial stack pointer at the top of the user space.
 
         uint8_t *argstr_head;
@@ -1,10 +1,25 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include "threads/interrupt.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "lib/kernel/hash.h"
 
+/** A forked child's exit status, kept for its parent's wait().
+   Shared by the parent, on its CHILDREN list, and the child, as
+   its EXIT_RECORD, and freed by whichever lets go of it last. */
+struct child_status
+  {
+    tid_t tid;                  /**< Child's thread id. */
+    int exit_status;            /**< Set when the child exits. */
+    struct semaphore dead;      /**< Upped when the child exits. */
+    int ref_cnt;                /**< Parent and child, while alive. */
+    struct list_elem elem;      /**< Element in the parent's CHILDREN. */
+  };
+
 tid_t process_execute (const char *file_name);
+tid_t process_fork (struct intr_frame *);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
@@ -1,23 +1,38 @@
 #include "userprog/syscall.h"
+#include <iovec.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "userprog/process.h"
+#include "vm/frame.h"
 
 //FUNCTION DECLARATIONS
 
 static void syscall_handler(struct intr_frame *);
 static void sys_halt(void);
 static void sys_exit(int);
+static bool sys_create(const char *, unsigned);
+static int sys_wait(tid_t);
 static int sys_open(const char *);
 static int sys_write(int, const void *, unsigned);
+static void sys_seek(int, unsigned);
+static unsigned sys_tell(int);
+static int sys_readv(int, const struct iovec *, int);
+static int sys_writev(int, const struct iovec *, int);
 static void sys_close(int);
 
-static struct file_descriptor *get_open_file(int);
-static void close_open_file(int);
+static struct file_descriptor *get_open_file(int, tid_t);
+static void close_open_file(int, tid_t);
 static bool is_valid_uvaddr(const void *);
 static int allocate_fd(void);
+static bool pin_iovec(struct iovec *, const struct iovec *, int, bool);
+static void unpin_iovec(const struct iovec *, int);
 
 //
 
@@ -25,7 +40,7 @@ void syscall_init(void)
 {
   intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
   list_init(&open_files);
-  lock_init(&fs_lock);
+  lock_init(&files_lock);
 }
 
 static void
@@ -50,6 +65,9 @@ syscall_handler(struct intr_frame *f)
     case SYS_EXIT:
       sys_exit(*(esp + 1));
       break;
+    case SYS_CREATE:
+      f->eax = sys_create((char *)*(esp + 1), *(esp + 2));
+      break;
     case SYS_OPEN:
       f->eax = sys_open((char *)*(esp + 1));
       break;
@@ -59,6 +77,24 @@ syscall_handler(struct intr_frame *f)
     case SYS_WRITE:
       f->eax = sys_write(*(esp + 1), (void *)*(esp + 2), *(esp + 3));
       break;
+    case SYS_SEEK:
+      sys_seek(*(esp + 1), *(esp + 2));
+      break;
+    case SYS_TELL:
+      f->eax = sys_tell(*(esp + 1));
+      break;
+    case SYS_FORK:
+      f->eax = process_fork(f);
+      break;
+    case SYS_WAIT:
+      f->eax = sys_wait(*(esp + 1));
+      break;
+    case SYS_READV:
+      f->eax = sys_readv(*(esp + 1), (void *)*(esp + 2), *(esp + 3));
+      break;
+    case SYS_WRITEV:
+      f->eax = sys_writev(*(esp + 1), (void *)*(esp + 2), *(esp + 3));
+      break;
     default:
       break;
     }
@@ -72,24 +108,31 @@ void sys_halt(void)
 
 void sys_exit(int status)
 {
-  struct child_status *child;
   struct thread *cur = thread_current();
+  cur->exit_status = status;
   printf("%s: exit(%d)\n", cur->name, status);
   thread_exit();
 }
 
+int sys_wait(tid_t child)
+{
+  return process_wait(child);
+}
+
 int sys_open(const char *file_name)
 {
   struct file *f;
   struct file_descriptor *fd;
   int status = -1;
+  size_t name_size;
 
-  if (!is_valid_ptr(file_name))
+  /* keep the name resident while file system locks are held */
+  name_size = vm_frame_pin_string(file_name);
+  if (name_size == 0)
     exit(-1);
 
-  lock_acquire(&fs_lock);
-
   f = filesys_open(file_name);
+  lock_acquire(&files_lock);
   if (f != NULL)
   {
     fd = calloc(1, sizeof *fd);
@@ -99,18 +142,16 @@ int sys_open(const char *file_name)
     list_push_back(&open_files, &fd->elem);
     status = fd->fd_num;
   }
-  lock_release(&fs_lock);
+  lock_release(&files_lock);
+  vm_frame_unpin_buffer(file_name, name_size);
   return status;
 }
 
 void sys_close(int fd)
 {
-  struct file_descriptor *fd_struct;
-  lock_acquire(&fs_lock);
-  fd_struct = get_open_file(fd);
-  if (fd_struct != NULL && fd_struct->owner == thread_current()->tid)
-    close_open_file(fd);
-  lock_release(&fs_lock);
+  lock_acquire(&files_lock);
+  close_open_file(fd, thread_current()->tid);
+  lock_release(&files_lock);
   return;
 }
 
@@ -119,34 +160,12 @@ int sys_write(int fd, const void *buffer, unsigned size)
   struct file_descriptor *fd_struct;
   int status = 0;
 
-  unsigned buffer_size = size;
-  void *buffer_tmp = buffer;
-
-  /* check the user memory pointing by buffer are valid */
-  while (buffer_tmp != NULL)
-  {
-    if (!is_valid_ptr(buffer_tmp))
-      exit(-1);
+  /* check the user memory pointing by buffer are valid, and fault it
+     in and pin it before the write takes any file system lock, so that
+     no page fault can do file or swap I/O while one is held */
+  if (!vm_frame_pin_buffer(buffer, size, false))
+    exit(-1);
 
-    /* Advance */
-    if (buffer_size > PGSIZE)
-    {
-      buffer_tmp += PGSIZE;
-      buffer_size -= PGSIZE;
-    }
-    else if (buffer_size == 0)
-    {
-      /* terminate the checking loop */
-      buffer_tmp = NULL;
-    }
-    else
-    {
-      /* last loop */
-      buffer_tmp = buffer + size - 1;
-      buffer_size = 0;
-    }
-  }
-  lock_acquire(&fs_lock);
   if (fd == STDIN_FILENO)
   {
     status = -1;
@@ -158,26 +177,114 @@ int sys_write(int fd, const void *buffer, unsigned size)
   }
   else
   {
-    fd_struct = get_open_file(fd);
+    /* only this process closes its descriptors, so the file stays
+       open after the list lock is dropped */
+    lock_acquire(&files_lock);
+    fd_struct = get_open_file(fd, thread_current()->tid);
+    lock_release(&files_lock);
     if (fd_struct != NULL)
       status = file_write(fd_struct->file_struct, buffer, size);
   }
-  lock_release(&fs_lock);
+  vm_frame_unpin_buffer(buffer, size);
+
+  return status;
+}
+
+void sys_seek(int fd, unsigned position)
+{
+  struct file_descriptor *fd_struct;
+
+  lock_acquire(&files_lock);
+  fd_struct = get_open_file(fd, thread_current()->tid);
+  lock_release(&files_lock);
+  if (fd_struct != NULL)
+    file_seek(fd_struct->file_struct, position);
+}
+
+unsigned sys_tell(int fd)
+{
+  struct file_descriptor *fd_struct;
+  unsigned status = -1;
+
+  lock_acquire(&files_lock);
+  fd_struct = get_open_file(fd, thread_current()->tid);
+  lock_release(&files_lock);
+  if (fd_struct != NULL)
+    status = file_tell(fd_struct->file_struct);
+  return status;
+}
+
+int sys_readv(int fd, const struct iovec *uiov, int iovcnt)
+{
+  struct iovec iov[IOV_MAX];
+  struct file_descriptor *fd_struct;
+  int status = -1;
+
+  /* copy the buffer list in and pin every buffer, as sys_write does,
+     so that the whole transfer runs under one inode lock */
+  if (!pin_iovec(iov, uiov, iovcnt, true))
+    exit(-1);
+
+  if (fd != STDIN_FILENO && fd != STDOUT_FILENO)
+  {
+    lock_acquire(&files_lock);
+    fd_struct = get_open_file(fd, thread_current()->tid);
+    lock_release(&files_lock);
+    if (fd_struct != NULL)
+      status = file_readv(fd_struct->file_struct, iov, iovcnt);
+  }
+  unpin_iovec(iov, iovcnt);
+
+  return status;
+}
+
+int sys_writev(int fd, const struct iovec *uiov, int iovcnt)
+{
+  struct iovec iov[IOV_MAX];
+  struct file_descriptor *fd_struct;
+  int status = 0;
+  int i;
+
+  if (!pin_iovec(iov, uiov, iovcnt, false))
+    exit(-1);
+
+  if (fd == STDIN_FILENO)
+  {
+    status = -1;
+  }
+  else if (fd == STDOUT_FILENO)
+  {
+    for (i = 0; i < iovcnt; i++)
+    {
+      putbuf(iov[i].iov_base, iov[i].iov_len);
+      status += iov[i].iov_len;
+    }
+  }
+  else
+  {
+    lock_acquire(&files_lock);
+    fd_struct = get_open_file(fd, thread_current()->tid);
+    lock_release(&files_lock);
+    if (fd_struct != NULL)
+      status = file_writev(fd_struct->file_struct, iov, iovcnt);
+  }
+  unpin_iovec(iov, iovcnt);
 
   return status;
 }
 
 bool
-create (const char *file_name, unsigned size)
+sys_create (const char *file_name, unsigned size)
 {
   bool status;
+  size_t name_size;
 
-  if (!is_valid_ptr (file_name))
+  name_size = vm_frame_pin_string (file_name);
+  if (name_size == 0)
     exit (-1);
 
-  lock_acquire (&fs_lock);
   status = filesys_create(file_name, size);  
-  lock_release (&fs_lock);
+  vm_frame_unpin_buffer (file_name, name_size);
   return status;
 }
 
@@ -205,25 +312,120 @@ int allocate_fd()
   return ++fd_current;
 }
 
-void
-close_open_file (int fd)
+/* Copy the CNT entries of the user's buffer list UIOV into IOV and
+   pin the buffers they point to, for writing if WRITE.  Fails,
+   pinning nothing, if the list or a buffer is not valid user memory,
+   if CNT is out of range or if the buffers add up to more than an
+   int can count. */
+static bool
+pin_iovec(struct iovec *iov, const struct iovec *uiov, int cnt, bool write)
+{
+  size_t total = 0;
+  int i;
+
+  if (cnt < 0 || cnt > IOV_MAX)
+    return false;
+  if (!vm_frame_pin_buffer(uiov, cnt * sizeof *uiov, false))
+    return false;
+  memcpy(iov, uiov, cnt * sizeof *uiov);
+  vm_frame_unpin_buffer(uiov, cnt * sizeof *uiov);
+
+  for (i = 0; i < cnt; i++)
+  {
+    if (iov[i].iov_len > INT32_MAX - total)
+      break;
+    total += iov[i].iov_len;
+    if (!vm_frame_pin_buffer(iov[i].iov_base, iov[i].iov_len, write))
+      break;
+  }
+  if (i < cnt)
+  {
+    unpin_iovec(iov, i);
+    return false;
+  }
+  return true;
+}
+
+/* Release the pins taken by pin_iovec(). */
+static void
+unpin_iovec(const struct iovec *iov, int cnt)
+{
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    vm_frame_unpin_buffer(iov[i].iov_base, iov[i].iov_len);
+}
+
+/* Give process CHILD its own handles on the files PARENT has open,
+   under the same descriptors and at the same positions. */
+bool
+syscall_fork_files (tid_t parent, tid_t child)
 {
   struct list_elem *e;
-  struct list_elem *prev;
-  struct file_descriptor *fd_struct; 
-  e = list_end (&open_files);
-  while (e != list_head (&open_files)) 
+  struct file_descriptor *fd_struct, *copy;
+  bool success = true;
+
+  lock_acquire (&files_lock);
+  for (e = list_begin (&open_files); e != list_end (&open_files);
+       e = list_next (e))
     {
-      prev = list_prev (e);
       fd_struct = list_entry (e, struct file_descriptor, elem);
-      if (fd_struct->fd_num == fd)
-	{
-	  list_remove (e);
-          file_close (fd_struct->file_struct);
-	  free (fd_struct);
-	  return ;
-	}
-      e = prev;
+      if (fd_struct->owner != parent)
+        continue;
+
+      copy = calloc (1, sizeof *copy);
+      if (copy == NULL)
+        {
+          success = false;
+          break;
+        }
+      copy->file_struct = file_reopen (fd_struct->file_struct);
+      if (copy->file_struct == NULL)
+        {
+          free (copy);
+          success = false;
+          break;
+        }
+      file_seek (copy->file_struct, file_tell (fd_struct->file_struct));
+      copy->fd_num = fd_struct->fd_num;
+      copy->owner = child;
+      list_push_front (&open_files, &copy->elem);
+    }
+  lock_release (&files_lock);
+  return success;
+}
+
+/* Return descriptor FD of process OWNER, or NULL if OWNER has no
+   such descriptor.  After fork() parent and child have descriptors
+   with the same numbers, so both must match.  Must be called with
+   files_lock held. */
+static struct file_descriptor *
+get_open_file (int fd, tid_t owner)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&open_files); e != list_end (&open_files);
+       e = list_next (e))
+    {
+      struct file_descriptor *fd_struct
+        = list_entry (e, struct file_descriptor, elem);
+      if (fd_struct->fd_num == fd && fd_struct->owner == owner)
+        return fd_struct;
+    }
+  return NULL;
+}
+
+/* Close descriptor FD of process OWNER, if it has one.  Must be
+   called with files_lock held. */
+void
+close_open_file (int fd, tid_t owner)
+{
+  struct file_descriptor *fd_struct = get_open_file (fd, owner);
+
+  if (fd_struct != NULL)
+    {
+      list_remove (&fd_struct->elem);
+      file_close (fd_struct->file_struct);
+      free (fd_struct);
     }
-  return ;
 }
@@ -1,6 +1,11 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <list.h>
+#include <stdbool.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+
 struct file_descriptor
 {
   int fd_num;
@@ -9,9 +14,10 @@ struct file_descriptor
   struct list_elem elem;
 };
 
-struct lock fs_lock;
+struct lock files_lock;
 struct list open_files;
 
 void syscall_init (void);
+bool syscall_fork_files (tid_t parent, tid_t child);
 
 #endif /**< userprog/syscall.h */
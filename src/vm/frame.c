@@ -1,14 +1,19 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/palloc.h"
+#include "threads/vaddr.h"
 #include "lib/kernel/list.h"
 #include "userprog/pagedir.h"
 #include "vm/page.h"
 #include "threads/pte.h"
 #include "vm/swap.h"
+#include "vm/pagecache.h"
+#include "vm/vma.h"
+#include "userprog/syscall.h"
 
 #include "vm/frame.h"
 
@@ -18,24 +23,81 @@ static struct lock vm_lock;
 /* Lock to ensure eviction operations are atomic. */
 static struct lock eviction_lock;
 
+/* Processes with a frame allotment, and the lock protecting the
+   allotments and suspensions of all of them. */
+static struct list vm_procs;
+static struct lock pff_lock;
+
+/* Frames in the frame table, and how many the user pool holds once
+   it has first run dry (0 until then). */
+static size_t frame_cnt;
+static size_t frame_capacity;
+
+/* Process picked by the OOM killer that has yet to exit. */
+static tid_t oom_victim = TID_ERROR;
+
+/* How memory pressure has been relieved. */
+static unsigned long long reclaim_cnt;   /* Clean pages dropped. */
+static unsigned long long evict_cnt;     /* Pages compressed or swapped. */
+static unsigned long long throttle_cnt;  /* Waits for free memory. */
+static unsigned long long oom_kill_cnt;  /* Processes killed. */
+
 /* Frame table operations. */
 static bool add_vm_frame(void *);
 static void remove_vm_frame(void *);
 /* Retrieve the vm_frame struct corresponding to the given frame address. */
 static struct vm_frame *get_vm_frame(void *);
+static struct vm_frame *find_vm_frame(void *);
 
 /* Functions needed for eviction. */
-static struct vm_frame *frame_to_evict(void); // Select a frame for eviction.
+static struct vm_frame *frame_to_evict(tid_t, bool); // Select a frame for eviction.
+static struct vm_frame *evict_from(tid_t);
+/* Tell whether a frame can be dropped without writing it anywhere. */
+static bool frame_is_clean(struct vm_frame *, struct thread *);
+/* Free a frame when the pool is dry, however hard that is. */
+static void *reclaim_frame(enum palloc_flags);
+/* Kill the process with the highest OOM score. */
+static void oom_kill(struct thread *);
+/* Fault in and pin one page of the current process. */
+static bool pin_page(struct thread *, void *, bool);
+/* Choose whose frames to evict first. */
+static tid_t victim_owner(struct thread *);
+/* Move a frame to a new owner, keeping the owners' counts. */
+static void frame_set_owner(struct vm_frame *, struct thread *);
+
+/* Copy-on-write sharing after fork(). */
+static bool fork_swapped_page(struct thread *, struct suppl_pte *, void *);
+static bool share_frame(struct vm_frame *, struct thread *, void *, uint32_t *,
+                        struct thread *);
+static void frame_drop_mapping(struct vm_frame *, struct thread *, void *);
+static void release_frames(struct thread *, bool reap);
+
+/* Same-page merging. */
+static bool frame_ksm_candidate(struct vm_frame *);
+static void frame_write_protect(struct vm_frame *, struct thread *);
 /* Save the evicted frame's content to swap space. */
 static bool save_evicted_frame(struct vm_frame *);
+/* Unmap one process's mapping of an evicted frame, saving what it needs. */
+static bool save_mapping(struct vm_frame *, struct thread *, void *, uint32_t *);
+/* Release a slot held only as swap cache when swap is full. */
+static bool swap_cache_drop_one(const void *keep);
+/* Choose a swap slot close to the process's other swapped pages. */
+static size_t swap_slot_hint(struct thread *, void *);
+
+/* Load control. */
+static size_t running_quota(void);
+static void load_control_suspend(void);
+static void load_control_resume(void);
 
 /* Initialize the frame table and related data structures. */
 void
 vm_frame_init()
 {
   list_init(&vm_frames);
+  list_init(&vm_procs);
   lock_init(&vm_lock);
   lock_init(&eviction_lock);
+  lock_init(&pff_lock);
 }
 
 /* Allocate a frame from the user pool and add it to the frame table. */
@@ -57,12 +119,32 @@ vm_allocate_frame(enum palloc_flags flags)
   if (frame != NULL)
     add_vm_frame(frame);
   else
-    if ((frame = evict_frame()) == NULL)
-      PANIC("Eviction failed while trying to allocate a frame.");
+    {
+      /* The pool is dry: now we know how many frames it holds. */
+      if (frame_cnt > frame_capacity)
+        frame_capacity = frame_cnt;
+      frame = reclaim_frame(flags);
+    }
 
   return frame;
 }
 
+/* Allocate a frame from the user pool only if one is free.  Unlike
+   vm_allocate_frame(), never evicts; used for speculative loads that
+   must not push out pages somebody is using. */
+void *
+vm_try_allocate_frame(enum palloc_flags flags)
+{
+  void *frame = palloc_get_page(flags | PAL_USER);
+
+  if (frame != NULL && !add_vm_frame(frame))
+    {
+      palloc_free_page(frame);
+      frame = NULL;
+    }
+  return frame;
+}
+
 /* Free a frame and remove its entry from the frame table. */
 void
 vm_free_frame(void *frame)
@@ -86,6 +168,154 @@ vm_frame_set_usr(void *frame, uint32_t *pte, void *upage)
     }
 }
 
+/* Mark FRAME as filled by swap readahead, so the clock can tell
+   whether the speculation paid off. */
+void
+vm_frame_mark_readahead(void *frame)
+{
+  struct vm_frame *vf;
+  vf = get_vm_frame(frame);
+  if (vf != NULL)
+    vf->readahead = true;
+}
+
+/* Mark FRAME as a page-cache frame.  Called by the page cache with
+   its lock held, which is why the frame table keeps its own flag:
+   the page cache's lock is always taken before vm_lock, never
+   after. */
+void
+vm_frame_mark_pagecached(void *frame)
+{
+  struct vm_frame *vf;
+  vf = get_vm_frame(frame);
+  if (vf != NULL)
+    vf->pagecached = true;
+}
+
+/* Start accounting frames to user process T. */
+void
+vm_frame_process_init(struct thread *t)
+{
+  t->frame_quota = PFF_INITIAL_FRAMES;
+  t->last_fault = timer_ticks();
+  t->suspended = false;
+
+  lock_acquire(&pff_lock);
+  list_push_back(&vm_procs, &t->vm_elem);
+  lock_release(&pff_lock);
+}
+
+/* Stop accounting frames to exiting thread T.  Its frames and its
+   allotment are given back, which may let a suspended process run
+   again. */
+void
+vm_frame_process_exit(struct thread *t)
+{
+  if (t->pagedir != NULL)
+    {
+      lock_acquire(&eviction_lock);
+      lock_acquire(&vm_lock);
+      release_frames(t, false);
+      lock_release(&vm_lock);
+      lock_release(&eviction_lock);
+    }
+
+  /* Kernel threads never had an allotment. */
+  if (t->frame_quota == 0)
+    return;
+
+  lock_acquire(&pff_lock);
+  list_remove(&t->vm_elem);
+  if (oom_victim == t->tid)
+    oom_victim = TID_ERROR;
+  load_control_resume();
+  lock_release(&pff_lock);
+}
+
+/* Page-fault-frequency controller, run on every fault that needs a
+   page brought in.  Frequent faults mean the working set does not
+   fit in the allotment; rare ones mean the allotment holds pages
+   that are no longer used.  Returns false if the OOM killer has
+   picked the process, which the fault must then kill. */
+bool
+vm_frame_pff_fault(void)
+{
+  struct thread *cur = thread_current();
+  int64_t now = timer_ticks();
+  int64_t gap = now - cur->last_fault;
+
+  if (cur->oom_killed)
+    return false;
+
+  lock_acquire(&pff_lock);
+  if (gap < PFF_GROW_TICKS)
+    {
+      cur->frame_quota += PFF_GROW_STEP;
+      if (frame_capacity > 0 && cur->frame_quota > frame_capacity)
+        cur->frame_quota = frame_capacity;
+      load_control_suspend();
+    }
+  else if (gap > PFF_TRIM_TICKS && cur->frame_quota > PFF_MIN_FRAMES)
+    {
+      cur->frame_quota -= cur->frame_quota / 4;
+      if (cur->frame_quota < PFF_MIN_FRAMES)
+        cur->frame_quota = PFF_MIN_FRAMES;
+      load_control_resume();
+    }
+  cur->last_fault = now;
+  lock_release(&pff_lock);
+  return true;
+}
+
+/* Sit out a load-control suspension of the current process, if any,
+   but not forever: the process we are making room for might be
+   waiting on us.  Called on the way back to user mode, where the
+   process holds no locks and is not in the middle of a fault or a
+   system call. */
+void
+vm_frame_load_control(void)
+{
+  struct thread *cur = thread_current();
+
+  if (!cur->suspended)
+    return;
+
+  lock_acquire(&pff_lock);
+  while (cur->suspended)
+    {
+      if (timer_elapsed(cur->suspended_at) >= PFF_SUSPEND_MAX_TICKS)
+        {
+          cur->suspended = false;
+          break;
+        }
+      lock_release(&pff_lock);
+      timer_sleep(PFF_SUSPEND_TICKS);
+      lock_acquire(&pff_lock);
+    }
+  cur->last_fault = timer_ticks();
+  lock_release(&pff_lock);
+}
+
+/* Pick a frame of OWNER to evict, or of any process if OWNER is
+   TID_ERROR: a clean one if possible, else one that must be
+   compressed or written to swap. */
+static struct vm_frame *
+evict_from(tid_t owner)
+{
+  struct vm_frame *vf;
+
+  vf = frame_to_evict(owner, true);
+  if (vf != NULL)
+    {
+      reclaim_cnt++;
+      return vf;
+    }
+  vf = frame_to_evict(owner, false);
+  if (vf != NULL)
+    evict_cnt++;
+  return vf;
+}
+
 /* Evict a frame and prepare its content for swapping. */
 void *
 evict_frame()
@@ -93,40 +323,95 @@ evict_frame()
   bool result;
   struct vm_frame *vf;
   struct thread *t = thread_current();
+  tid_t owner;
 
   lock_acquire(&eviction_lock);
 
-  vf = frame_to_evict();
-  if (vf == NULL)
-    PANIC("No frame available for eviction.");
+  /* A process over its allotment, or a suspended one, gives up its
+     own pages, clean ones first since they cost no I/O to drop,
+     before anyone else's are touched. */
+  owner = victim_owner(t);
+  vf = evict_from(owner);
+  if (vf == NULL && owner != TID_ERROR)
+    vf = evict_from(TID_ERROR);
 
-  result = save_evicted_frame(vf);
+  result = vf != NULL && save_evicted_frame(vf);
   if (!result)
-    PANIC("Failed to save evicted frame to swap space.");
+    {
+      lock_release(&eviction_lock);
+      return NULL;
+    }
   
   /* Reset frame metadata. */
-  vf->tid = t->tid;
+  frame_set_owner(vf, t);
   vf->pte = NULL;
   vf->uva = NULL;
+  vf->readahead = false;
+  vf->pagecached = false;
+  vf->merged = false;
+  vf->ksm_sum = 0;
 
   lock_release(&eviction_lock);
 
   return vf->frame;
 }
 
-/* Select a frame to evict using the clock algorithm. */
+/* Pick the process whose frames go first: a suspended process, then
+   the faulting process T if it has used up its allotment, then the
+   process furthest over its allotment.  Returns TID_ERROR to let the
+   clock choose among all frames. */
+static tid_t
+victim_owner(struct thread *t)
+{
+  struct list_elem *e;
+  struct thread *p, *over = NULL;
+  size_t excess = 0;
+
+  lock_acquire(&pff_lock);
+  for (e = list_begin(&vm_procs); e != list_end(&vm_procs); e = list_next(e))
+    {
+      p = list_entry(e, struct thread, vm_elem);
+      if (p->suspended && p->frame_cnt > 0)
+        {
+          lock_release(&pff_lock);
+          return p->tid;
+        }
+      if (p->frame_cnt > p->frame_quota
+          && p->frame_cnt - p->frame_quota > excess)
+        {
+          over = p;
+          excess = p->frame_cnt - p->frame_quota;
+        }
+    }
+  lock_release(&pff_lock);
+
+  if (t->pagedir != NULL && t->frame_cnt > 0
+      && t->frame_cnt >= t->frame_quota)
+    return t->tid;
+  return over != NULL ? over->tid : TID_ERROR;
+}
+
+/* Select a frame to evict using the clock algorithm, among the
+   frames of OWNER, or among all frames if OWNER is TID_ERROR.  If
+   CLEAN_ONLY, only frames that can be dropped without I/O are
+   considered. */
 static struct vm_frame *
-frame_to_evict()
+frame_to_evict(tid_t owner, bool clean_only)
 {
   struct vm_frame *vf;
   struct thread *t;
   struct list_elem *e;
 
   struct vm_frame *vf_class0 = NULL;
+  struct pagedir_batch batch;
 
   int round_count = 1;
   bool found = false;
 
+  /* Accessed bits cleared in the running process's page directory
+     are flushed from the TLB once, after the scan. */
+  pagedir_batch_init(&batch);
+
   /* Iterate through the frame table to find a candidate for eviction. */
   while (!found)
     {
@@ -134,8 +419,55 @@ frame_to_evict()
       while ((e = list_next(e)) != list_tail(&vm_frames))
         {
           vf = list_entry(e, struct vm_frame, elem);
+          if (owner != TID_ERROR && vf->tid != owner)
+            continue;
+          if (vf->pin_cnt > 0)
+            continue;
           t = thread_get_by_id(vf->tid);
-          bool accessed = pagedir_is_accessed(t->pagedir, vf->uva);
+          if (clean_only && !frame_is_clean(vf, t))
+            continue;
+          bool accessed;
+
+          if (vf->pagecached)
+            {
+              /* A shared frame is in use if any sharer touched it. */
+              accessed = pagecache_test_and_clear_accessed(vf->frame, &batch);
+              if (accessed && vf->readahead && t != NULL)
+                vm_page_readahead_outcome(t, vf->uva, true);
+              if (accessed)
+                {
+                  vf->readahead = false;
+                  continue;
+                }
+            }
+          else
+            {
+              struct list_elem *m;
+
+              /* A frame whose owner has exited counts as unused. */
+              accessed = t != NULL
+                         && pagedir_test_and_clear_accessed(t->pagedir,
+                                                            vf->uva, &batch);
+
+              /* So is a frame shared copy-on-write after fork(). */
+              for (m = list_begin(&vf->cow_maps); m != list_end(&vf->cow_maps);
+                   m = list_next(m))
+                {
+                  struct cow_map *cm = list_entry(m, struct cow_map, elem);
+                  if (pagedir_test_and_clear_accessed(cm->t->pagedir, cm->uva,
+                                                      &batch))
+                    accessed = true;
+                }
+            }
+
+          /* A readahead page that has been touched was a hit. */
+          if (accessed && vf->readahead)
+            {
+              if (t != NULL)
+                vm_page_readahead_outcome(t, vf->uva, true);
+              vf->readahead = false;
+            }
+
           if (!accessed)
             {
               vf_class0 = vf;
@@ -143,64 +475,1004 @@ frame_to_evict()
               list_push_back(&vm_frames, e);
               break;
             }
-          else
-            {
-              pagedir_set_accessed(t->pagedir, vf->uva, false);
-            }
         }
 
       if (vf_class0 != NULL || round_count++ == 2)
         found = true;
     }
 
+  pagedir_batch_flush(&batch);
   return vf_class0;
 }
 
+/* Fault in and pin the pages of the user buffer of SIZE bytes at UADDR,
+   so that a system call can use it under the file system lock without
+   page faults, and the disk I/O they may cause, in between. */
+bool
+vm_frame_pin_buffer(const void *uaddr, size_t size, bool write)
+{
+  struct thread *t = thread_current();
+  const uint8_t *start = uaddr;
+  uint8_t *upage;
+
+  if (size == 0)
+    return true;
+  if (start + size - 1 < start || !is_user_vaddr(start + size - 1))
+    return false;
+
+  for (upage = pg_round_down(start); upage <= start + size - 1;
+       upage += PGSIZE)
+    if (!pin_page(t, upage, write))
+      {
+        if (upage > start)
+          vm_frame_unpin_buffer(start, upage - start);
+        return false;
+      }
+  return true;
+}
+
+/* Pin the pages of the user string STR, up to its terminator. */
+size_t
+vm_frame_pin_string(const char *str)
+{
+  struct thread *t = thread_current();
+  const char *p = str;
+
+  for (;;)
+    {
+      const char *page_end = (const char *) pg_round_down(p) + PGSIZE;
+
+      if (!pin_page(t, pg_round_down(p), false))
+        {
+          if (p > str)
+            vm_frame_unpin_buffer(str, p - str);
+          return 0;
+        }
+      for (; p < page_end; p++)
+        if (*p == '\0')
+          return p - str + 1;
+    }
+}
+
+/* Release the pins taken on the buffer of SIZE bytes at UADDR. */
+void
+vm_frame_unpin_buffer(const void *uaddr, size_t size)
+{
+  struct thread *t = thread_current();
+  const uint8_t *start = uaddr;
+  uint8_t *upage;
+
+  if (size == 0)
+    return;
+
+  lock_acquire(&eviction_lock);
+  for (upage = pg_round_down(start); upage <= start + size - 1;
+       upage += PGSIZE)
+    {
+      struct vm_frame *vf = get_vm_frame(pagedir_get_page(t->pagedir, upage));
+      if (vf != NULL)
+        {
+          ASSERT(vf->pin_cnt > 0);
+          vf->pin_cnt--;
+        }
+    }
+  lock_release(&eviction_lock);
+}
+
+/* Bring UPAGE of T in and pin its frame.  Eviction may take the page
+   again between loading and pinning, hence the loop.  Pages mapped
+   to the shared zero page have no frame to pin, and need none. */
+static bool
+pin_page(struct thread *t, void *upage, bool write)
+{
+  for (;;)
+    {
+      void *kpage;
+
+      if (!vm_page_fault_in(upage, write))
+        return false;
+
+      lock_acquire(&eviction_lock);
+      kpage = pagedir_get_page(t->pagedir, upage);
+      if (kpage != NULL)
+        {
+          struct vm_frame *vf = get_vm_frame(kpage);
+          if (vf != NULL)
+            vf->pin_cnt++;
+          lock_release(&eviction_lock);
+          return true;
+        }
+      lock_release(&eviction_lock);
+    }
+}
+
+/* Give CHILD, a process just forked from PARENT, PARENT's pages.
+   Resident frames are shared copy-on-write: both map them read-only
+   and the first write gets the writer a copy of its own.  Pages that
+   are only in swap are copied to slots of the child's.  Holding the
+   eviction lock keeps PARENT's pages where they are meanwhile. */
+bool
+vm_frame_fork(struct thread *parent, struct thread *child)
+{
+  struct hash_iterator i;
+  struct list_elem *e;
+  void *bounce;
+  bool success = true;
+
+  bounce = palloc_get_page(0);
+  if (bounce == NULL)
+    return false;
+
+  lock_acquire(&eviction_lock);
+
+  /* Slots kept as swap cache belong to resident pages, which are
+     shared below instead. */
+  hash_first(&i, &parent->suppl_page_table);
+  while (success && hash_next(&i))
+    {
+      struct suppl_pte *spte = hash_entry(hash_cur(&i), struct suppl_pte, elem);
+      if (!spte->is_loaded)
+        success = fork_swapped_page(child, spte, bounce);
+    }
+
+  lock_acquire(&vm_lock);
+  for (e = list_begin(&vm_frames); success && e != list_end(&vm_frames);
+       e = list_next(e))
+    {
+      struct vm_frame *vf = list_entry(e, struct vm_frame, elem);
+      struct list_elem *m;
+
+      if (vf->tid == parent->tid && vf->uva != NULL)
+        success = share_frame(vf, parent, vf->uva, vf->pte, child);
+      for (m = list_begin(&vf->cow_maps);
+           success && m != list_end(&vf->cow_maps); m = list_next(m))
+        {
+          struct cow_map *cm = list_entry(m, struct cow_map, elem);
+          if (cm->t == parent)
+            success = share_frame(vf, parent, cm->uva, cm->pte, child);
+        }
+    }
+  lock_release(&vm_lock);
+
+  lock_release(&eviction_lock);
+  palloc_free_page(bounce);
+  return success;
+}
+
+/* Handle a write by T to UPAGE, mapped copy-on-write to a frame that
+   fork() shared.  The last process left using the frame takes it
+   over; the others copy it.  The frame is pinned while it is copied,
+   since allocating the copy may evict. */
+bool
+vm_frame_cow(struct thread *t, void *upage)
+{
+  struct vm_frame *vf;
+  void *kpage, *copy;
+
+  lock_acquire(&eviction_lock);
+  kpage = pagedir_get_page(t->pagedir, upage);
+  if (kpage == NULL)
+    {
+      /* Evicted meanwhile: the write faults again and loads it. */
+      lock_release(&eviction_lock);
+      return true;
+    }
+  vf = get_vm_frame(kpage);
+  if (vf == NULL)
+    {
+      lock_release(&eviction_lock);
+      return false;
+    }
+  if (list_empty(&vf->cow_maps))
+    {
+      pagedir_unshare_cow(t->pagedir, upage);
+      lock_release(&eviction_lock);
+      return true;
+    }
+  vf->pin_cnt++;
+  lock_release(&eviction_lock);
+
+  copy = vm_allocate_frame(PAL_USER);
+  if (copy != NULL)
+    memcpy(copy, kpage, PGSIZE);
+
+  lock_acquire(&eviction_lock);
+  vf->pin_cnt--;
+  if (copy != NULL && list_empty(&vf->cow_maps))
+    {
+      /* The other sharers exited while we copied. */
+      pagedir_unshare_cow(t->pagedir, upage);
+      lock_release(&eviction_lock);
+      vm_free_frame(copy);
+      return true;
+    }
+  if (copy != NULL)
+    {
+      lock_acquire(&vm_lock);
+      frame_drop_mapping(vf, t, upage);
+      lock_release(&vm_lock);
+
+      /* The page table already exists, so mapping cannot fail. */
+      pagedir_clear_page(t->pagedir, upage);
+      pagedir_set_page(t->pagedir, upage, copy, true);
+      vm_frame_set_usr(copy, pagedir_get_pte(t->pagedir, upage), upage);
+    }
+  lock_release(&eviction_lock);
+
+  return copy != NULL;
+}
+
+/* Collect up to MAX frames for the merging scanner that it has not
+   visited in ROUND yet. */
+size_t
+vm_frame_ksm_collect(void **kpages, size_t max, unsigned round)
+{
+  struct list_elem *e;
+  size_t cnt = 0;
+
+  lock_acquire(&eviction_lock);
+  lock_acquire(&vm_lock);
+  for (e = list_begin(&vm_frames); cnt < max && e != list_end(&vm_frames);
+       e = list_next(e))
+    {
+      struct vm_frame *vf = list_entry(e, struct vm_frame, elem);
+      if (vf->ksm_round == round || !frame_ksm_candidate(vf))
+        continue;
+      vf->ksm_round = round;
+      kpages[cnt++] = vf->frame;
+    }
+  lock_release(&vm_lock);
+  lock_release(&eviction_lock);
+
+  return cnt;
+}
+
+/* Checksum KPAGE for the merging scanner.  A page whose checksum
+   changes between visits is being written and is not worth merging. */
+bool
+vm_frame_ksm_checksum(void *kpage, unsigned *sum)
+{
+  struct vm_frame *vf;
+  bool stable = false;
+
+  lock_acquire(&eviction_lock);
+  lock_acquire(&vm_lock);
+  vf = find_vm_frame(kpage);
+  if (vf != NULL && frame_ksm_candidate(vf))
+    {
+      *sum = hash_bytes(kpage, PGSIZE);
+      stable = vf->ksm_sum == *sum;
+      vf->ksm_sum = *sum;
+    }
+  lock_release(&vm_lock);
+  lock_release(&eviction_lock);
+
+  return stable;
+}
+
+/* Merge frame DUP into frame KEEP.  Both are write-protected before
+   the final comparison, so that a write from then on faults and
+   waits for the eviction lock rather than changing a page we are
+   merging. */
+bool
+vm_frame_merge(void *keep, void *dup)
+{
+  struct vm_frame *kf, *df;
+  struct cow_map *m;
+  struct thread *kt = NULL, *t = NULL;
+  bool merged = false;
+
+  m = malloc(sizeof *m);
+  if (m == NULL)
+    return false;
+
+  lock_acquire(&eviction_lock);
+  lock_acquire(&vm_lock);
+  kf = find_vm_frame(keep);
+  df = find_vm_frame(dup);
+  if (kf != NULL && df != NULL)
+    {
+      kt = thread_get_by_id(kf->tid);
+      t = thread_get_by_id(df->tid);
+    }
+  if (kt != NULL && t != NULL && kf != df
+      && frame_ksm_candidate(kf) && frame_ksm_candidate(df)
+      && memcmp(keep, dup, PGSIZE) == 0)
+    {
+      frame_write_protect(kf, kt);
+      frame_write_protect(df, t);
+      merged = memcmp(keep, dup, PGSIZE) == 0;
+    }
+
+  if (merged)
+    {
+      /* DUP's owner becomes a sharer of KEEP, and so do its sharers. */
+      pagedir_move_cow(t->pagedir, df->uva, keep);
+      m->t = t;
+      m->uva = df->uva;
+      m->pte = df->pte;
+      list_push_back(&kf->cow_maps, &m->elem);
+      while (!list_empty(&df->cow_maps))
+        {
+          struct cow_map *cm = list_entry(list_pop_front(&df->cow_maps),
+                                          struct cow_map, elem);
+          pagedir_move_cow(cm->t->pagedir, cm->uva, keep);
+          list_push_back(&kf->cow_maps, &cm->elem);
+        }
+      kf->merged = true;
+
+      list_remove(&df->elem);
+      frame_cnt--;
+      t->frame_cnt--;
+      free(df);
+    }
+  lock_release(&vm_lock);
+  lock_release(&eviction_lock);
+
+  if (merged)
+    palloc_free_page(dup);
+  else
+    free(m);
+  return merged;
+}
+
+/* Count the frames holding merged pages and their extra mappings. */
+void
+vm_frame_ksm_stats(size_t *shared, size_t *sharing)
+{
+  struct list_elem *e;
+
+  *shared = *sharing = 0;
+  lock_acquire(&vm_lock);
+  for (e = list_begin(&vm_frames); e != list_end(&vm_frames); e = list_next(e))
+    {
+      struct vm_frame *vf = list_entry(e, struct vm_frame, elem);
+      if (vf->merged && !list_empty(&vf->cow_maps))
+        {
+          (*shared)++;
+          *sharing += list_size(&vf->cow_maps);
+        }
+    }
+  lock_release(&vm_lock);
+}
+
+/* Returns true if the merging scanner may merge VF: a private frame
+   of a writable area that is not a mapped file, and that no system
+   call or readahead is holding on to.  Must be called with
+   eviction_lock and vm_lock held. */
+static bool
+frame_ksm_candidate(struct vm_frame *vf)
+{
+  struct thread *t;
+  struct vm_area *vma;
+
+  if (vf->uva == NULL || vf->pte == NULL || vf->pin_cnt > 0 || vf->readahead)
+    return false;
+  /* Page cache frames are mapped read-only and not copy-on-write. */
+  if (!(*vf->pte & (PTE_W | PTE_COW)) || !(*vf->pte & PTE_P))
+    return false;
+  t = thread_get_by_id(vf->tid);
+  if (t == NULL || t->pagedir == NULL)
+    return false;
+  vma = vma_find(t, vf->uva);
+  return vma != NULL && vma->writable && vma->type != VMA_MMAP;
+}
+
+/* Make every mapping of VF, owned by T, read-only and copy-on-write. */
+static void
+frame_write_protect(struct vm_frame *vf, struct thread *t)
+{
+  struct list_elem *e;
+
+  pagedir_share_cow(t->pagedir, vf->uva);
+  for (e = list_begin(&vf->cow_maps); e != list_end(&vf->cow_maps);
+       e = list_next(e))
+    {
+      struct cow_map *cm = list_entry(e, struct cow_map, elem);
+      pagedir_share_cow(cm->t->pagedir, cm->uva);
+    }
+}
+
+/* Returns true if VF, owned by T, can be evicted without writing it:
+   a shared file page, a clean page of a file area, or a clean page
+   whose swap slot still holds its contents. */
+static bool
+frame_is_clean(struct vm_frame *vf, struct thread *t)
+{
+  struct vm_area *vma;
+
+  if (vf->pagecached)
+    return true;
+  if (!list_empty(&vf->cow_maps))
+    return false;
+  if (t == NULL || vf->uva == NULL || pagedir_is_dirty(t->pagedir, vf->uva))
+    return false;
+  if (get_suppl_pte(&t->suppl_page_table, vf->uva) != NULL)
+    return true;
+  vma = vma_find(t, vf->uva);
+  return vma != NULL && vma_is_file(vma);
+}
+
+/* The user pool is dry: free a frame with a graded response to memory
+   pressure.  Eviction drops clean pages first and compresses or swaps
+   out the rest.  If nothing can be evicted, the caller waits for
+   memory to be freed; if that does not happen, the OOM killer picks a
+   process to kill.  Returns a frame in the frame table, or a null
+   pointer if the caller has been picked by the OOM killer or freeing
+   memory takes too long after that, in which case the fault or system
+   call that wanted the frame terminates the process. */
+static void *
+reclaim_frame(enum palloc_flags flags)
+{
+  struct thread *cur = thread_current();
+  void *frame;
+  int tries;
+
+  for (tries = 1; ; tries++)
+    {
+      if (cur->oom_killed)
+        return NULL;
+
+      frame = evict_frame();
+      if (frame != NULL)
+        return frame;
+
+      /* Throttle: exiting processes may give memory back. */
+      throttle_cnt++;
+      if (tries == OOM_THROTTLE_TRIES)
+        oom_kill(cur);
+      else if (tries == 2 * OOM_THROTTLE_TRIES)
+        {
+          printf("Out of memory: %s (tid %d) gave up waiting\n",
+                 cur->name, cur->tid);
+          return NULL;
+        }
+      timer_sleep(OOM_THROTTLE_TICKS);
+
+      frame = palloc_get_page(flags | PAL_USER);
+      if (frame != NULL)
+        {
+          if (add_vm_frame(frame))
+            return frame;
+          palloc_free_page(frame);
+        }
+    }
+}
+
+/* Kill the process with the highest OOM score, unless an earlier
+   victim has yet to exit.  The victim dies the next time it faults
+   or allocates a frame, but it may be blocked and do neither for a
+   long time, so its frames are taken from it at once, except those a
+   system call has pinned; it faults as soon as it touches its memory
+   again.  If CUR is the victim, its next attempt to reclaim a frame
+   fails. */
+static void
+oom_kill(struct thread *cur)
+{
+  struct list_elem *e;
+  struct thread *victim = NULL;
+  tid_t victim_tid = TID_ERROR;
+  size_t best = 0;
+
+  lock_acquire(&pff_lock);
+  if (oom_victim != TID_ERROR)
+    {
+      lock_release(&pff_lock);
+      return;
+    }
+  for (e = list_begin(&vm_procs); e != list_end(&vm_procs); e = list_next(e))
+    {
+      struct thread *p = list_entry(e, struct thread, vm_elem);
+      size_t score = vm_frame_oom_score(p);
+
+      if (!p->oom_killed && (victim == NULL || score > best))
+        {
+          victim = p;
+          best = score;
+        }
+    }
+  if (victim != NULL)
+    {
+      printf("Out of memory: killing %s (tid %d), score %zu "
+             "(%zu resident, %zu in swap)\n",
+             victim->name, victim->tid, best, victim->frame_cnt,
+             victim->swapped_cnt);
+      victim->oom_killed = true;
+      oom_victim = victim_tid = victim->tid;
+      oom_kill_cnt++;
+    }
+  lock_release(&pff_lock);
+
+  if (victim_tid != TID_ERROR && victim_tid != cur->tid)
+    {
+      /* With eviction_lock held the victim cannot get past
+         release_frames() in its exit, so if it is still there it is
+         safe to use. */
+      lock_acquire(&eviction_lock);
+      lock_acquire(&vm_lock);
+      victim = thread_get_by_id(victim_tid);
+      if (victim != NULL && victim->pagedir != NULL)
+        release_frames(victim, true);
+      lock_release(&vm_lock);
+      lock_release(&eviction_lock);
+    }
+}
+
+/* Returns T's OOM score: the frames it holds plus the swap slots its
+   pages take up. */
+size_t
+vm_frame_oom_score(struct thread *t)
+{
+  return t->frame_cnt + t->swapped_cnt;
+}
+
+/* Print how memory pressure was relieved. */
+void
+vm_frame_print_stats(void)
+{
+  printf("Frames: %llu clean pages reclaimed, %llu pages evicted, "
+         "%llu waits for memory, %llu processes killed\n",
+         reclaim_cnt, evict_cnt, throttle_cnt, oom_kill_cnt);
+}
+
 /* Save the content of the evicted frame to swap space. */
 static bool
 save_evicted_frame(struct vm_frame *vf)
 {
   struct thread *t;
-  struct suppl_pte *spte;
 
-  /* Get the thread and its supplemental page table. */
+  /* Get the thread owning the frame. */
   t = thread_get_by_id(vf->tid);
 
-  /* Retrieve or create a supplemental page table entry for the frame's virtual address. */
-  spte = get_suppl_pte(&t->suppl_page_table, vf->uva);
-  if (spte == NULL)
+  /* A shared read-only file page is clean: unmapping it from every
+     sharer is enough. */
+  if (vf->pagecached)
     {
-      spte = calloc(1, sizeof *spte);
-      spte->uvaddr = vf->uva;
-      spte->type = SWAP;
-      if (!insert_suppl_pte(&t->suppl_page_table, spte))
+      if (vf->readahead && t != NULL)
+        vm_page_readahead_outcome(t, vf->uva, false);
+      pagecache_evict(vf->frame);
+      memset(vf->frame, 0, PGSIZE);
+      return true;
+    }
+
+  /* A readahead page evicted before it was ever used was wasted I/O. */
+  if (vf->readahead && t != NULL)
+    vm_page_readahead_outcome(t, vf->uva, false);
+
+  /* A frame shared copy-on-write is saved once for every process
+     mapping it, sharers first, so that on failure the owner still
+     has it. */
+  while (!list_empty(&vf->cow_maps))
+    {
+      struct cow_map *m = list_entry(list_front(&vf->cow_maps),
+                                     struct cow_map, elem);
+      if (!save_mapping(vf, m->t, m->uva, m->pte))
         return false;
+      list_remove(&m->elem);
+      free(m);
     }
+  /* An owner that has exited has nothing left to save. */
+  if (t != NULL && !save_mapping(vf, t, vf->uva, vf->pte))
+    return false;
+
+  memset(vf->frame, 0, PGSIZE);
 
-  size_t swap_slot_idx;
+  return true;
+}
 
-  /* If the page is dirty or not a file, save it to swap space. */
-  if (pagedir_is_dirty(t->pagedir, spte->uvaddr) || (spte->type != FILE))
+/* Unmap frame VF from T, which maps it at UVA through PTE, and keep
+   what T needs to get the page back: nothing if its swap slot or its
+   file still holds it, else the file for a mapped file, else swap. */
+static bool
+save_mapping(struct vm_frame *vf, struct thread *t, void *uva, uint32_t *pte)
+{
+  struct suppl_pte *spte;
+  struct vm_area *vma;
+
+  /* Pages that have been to swap have an entry; all others are
+     described by their area alone. */
+  spte = get_suppl_pte(&t->suppl_page_table, uva);
+  vma = vma_find(t, uva);
+
+  size_t swap_slot_idx = SWAP_ERROR;
+  bool writable = (*pte & PTE_W)
+                  || ((*pte & PTE_COW) && vma != NULL && vma->writable);
+  bool dirty;
+
+  /* Clear the page mapping from the page directory first, so the owner
+     cannot dirty the page after we have decided it is clean. */
+  pagedir_clear_page(t->pagedir, uva);
+  dirty = pagedir_is_dirty(t->pagedir, uva);
+
+  if (spte != NULL && !dirty)
     {
-      swap_slot_idx = page_to_swap(spte->uvaddr);
+      /* The swap slot the page was read from still holds the same
+         data: dropping the mapping is all it takes. */
+      spte->is_loaded = false;
+      t->swapped_cnt++;
+    }
+  else if (spte == NULL && vma != NULL && vma->type == VMA_MMAP)
+    {
+      /* Mapped files take their changes back; the page is reread
+         from the file on the next fault. */
+      if (dirty)
+        file_write_at(vma->file, vf->frame,
+                      vma_page_read_bytes(vma, uva),
+                      vma_page_ofs(vma, uva));
+    }
+  else if (dirty || spte != NULL || vma == NULL || vma->type != VMA_FILE)
+    {
+      /* The page is dirty or anonymous: save it to swap space.  A
+         stale swap cache copy is rewritten in place when possible. */
+      size_t hint = swap_slot_hint(t, uva);
+      if (spte != NULL)
+        {
+          hint = spte->swap_slot_idx;
+          swap_clean_slot(spte->swap_slot_idx);
+        }
+      else
+        {
+          spte = calloc(1, sizeof *spte);
+          if (spte == NULL)
+            return false;
+          spte->uvaddr = uva;
+          if (!insert_suppl_pte(&t->suppl_page_table, spte))
+            {
+              free(spte);
+              return false;
+            }
+        }
+
+      swap_slot_idx = page_to_swap(vf->frame, hint);
+      while (swap_slot_idx == SWAP_ERROR && swap_cache_drop_one(uva))
+        swap_slot_idx = page_to_swap(vf->frame, hint);
       if (swap_slot_idx == SWAP_ERROR)
-        return false;
+        {
+          /* Swap is full: leave the page where it was, dirty, so
+             that nothing is lost. */
+          hash_delete(&t->suppl_page_table, &spte->elem);
+          free(spte);
+          *pte |= PTE_P | PTE_D;
+          return false;
+        }
 
-      spte->type |= SWAP;
+      t->swap_last_slot = swap_slot_idx;
+      spte->swap_slot_idx = swap_slot_idx;
+      spte->swap_writable = writable;
+      spte->is_loaded = false;
+      t->swapped_cnt++;
     }
 
-  memset(vf->frame, 0, PGSIZE);
+  return true;
+}
+
+/* Swap is full: take the slot away from one resident page that only
+   keeps it as a swap cache, so that a dirty victim can be written.
+   Only pages of the current process are considered, other than the
+   one at KEEP, which is being saved: nothing but its owner changes
+   a process's supplemental page table outside eviction.  Returns
+   false if no such page holds a slot. */
+static bool
+swap_cache_drop_one(const void *keep)
+{
+  struct thread *t = thread_current();
+  struct vm_frame *vf;
+  struct suppl_pte *spte;
+  struct list_elem *e;
+  bool dropped = false;
+
+  if (t->pagedir == NULL)
+    return false;
+
+  lock_acquire(&vm_lock);
+  e = list_head(&vm_frames);
+  while ((e = list_next(e)) != list_tail(&vm_frames))
+    {
+      vf = list_entry(e, struct vm_frame, elem);
+      if (vf->tid != t->tid || vf->uva == NULL || vf->uva == keep)
+        continue;
+
+      spte = get_suppl_pte(&t->suppl_page_table, vf->uva);
+      if (spte == NULL || !spte->is_loaded)
+        continue;
+
+      /* Without the slot the page may differ from what its area
+         says, so it must be written out when evicted. */
+      swap_clean_slot(spte->swap_slot_idx);
+      hash_delete(&t->suppl_page_table, &spte->elem);
+      free(spte);
+      pagedir_set_dirty(t->pagedir, vf->uva, true);
+      dropped = true;
+      break;
+    }
+  lock_release(&vm_lock);
+
+  return dropped;
+}
 
-  spte->swap_slot_idx = swap_slot_idx;
-  spte->swap_writable = *(vf->pte) & PTE_W;
-  spte->is_loaded = false;
+/* Pick the swap slot that keeps T's pages in address order on disk:
+   right after the slot of the page below UVA, right before the slot of
+   the page above it, or else right after T's last written slot. */
+static size_t
+swap_slot_hint(struct thread *t, void *uva)
+{
+  struct suppl_pte *neighbor;
+
+  neighbor = get_suppl_pte(&t->suppl_page_table, uva - PGSIZE);
+  if (neighbor != NULL && !neighbor->is_loaded)
+    return neighbor->swap_slot_idx + 1;
+
+  neighbor = get_suppl_pte(&t->suppl_page_table, uva + PGSIZE);
+  if (neighbor != NULL && !neighbor->is_loaded
+      && neighbor->swap_slot_idx > 0)
+    return neighbor->swap_slot_idx - 1;
+
+  if (t->swap_last_slot != SWAP_ERROR)
+    return t->swap_last_slot + 1;
+  return SWAP_ERROR;
+}
 
-  /* Clear the page mapping from the page directory. */
-  pagedir_clear_page(t->pagedir, spte->uvaddr);
+/* Hand VF over to T, moving it between the owners' frame counts. */
+static void
+frame_set_owner(struct vm_frame *vf, struct thread *t)
+{
+  struct thread *old;
 
+  lock_acquire(&vm_lock);
+  old = thread_get_by_id(vf->tid);
+  if (old != NULL)
+    old->frame_cnt--;
+  t->frame_cnt++;
+  vf->tid = t->tid;
+  lock_release(&vm_lock);
+}
+
+/* Copy the page of SPTE, which is only in swap, to a new slot for
+   CHILD, reading it through the kernel page BOUNCE. */
+static bool
+fork_swapped_page(struct thread *child, struct suppl_pte *spte, void *bounce)
+{
+  struct suppl_pte *copy;
+  size_t hint = swap_slot_hint(child, spte->uvaddr);
+
+  copy = calloc(1, sizeof *copy);
+  if (copy == NULL)
+    return false;
+
+  swap_read_slot(spte->swap_slot_idx, bounce);
+  copy->swap_slot_idx = page_to_swap(bounce, hint);
+  while (copy->swap_slot_idx == SWAP_ERROR && swap_cache_drop_one(NULL))
+    copy->swap_slot_idx = page_to_swap(bounce, hint);
+  if (copy->swap_slot_idx == SWAP_ERROR)
+    {
+      free(copy);
+      return false;
+    }
+
+  copy->uvaddr = spte->uvaddr;
+  copy->swap_writable = spte->swap_writable;
+  copy->is_loaded = false;
+  if (!insert_suppl_pte(&child->suppl_page_table, copy))
+    {
+      swap_clean_slot(copy->swap_slot_idx);
+      free(copy);
+      return false;
+    }
+  child->swap_last_slot = copy->swap_slot_idx;
+  child->swapped_cnt++;
   return true;
 }
 
+/* Share VF, which PARENT maps at UVA through PTE, copy-on-write with
+   CHILD.  Read-only frames are left alone: they hold file pages the
+   child reads from its own areas, through the page cache. */
+static bool
+share_frame(struct vm_frame *vf, struct thread *parent, void *uva,
+            uint32_t *pte, struct thread *child)
+{
+  struct cow_map *m;
+  bool dirty;
+
+  if (!(*pte & (PTE_W | PTE_COW)))
+    return true;
+
+  m = malloc(sizeof *m);
+  if (m == NULL)
+    return false;
+  if (!pagedir_set_page_cow(child->pagedir, uva, vf->frame))
+    {
+      free(m);
+      return false;
+    }
+
+  /* The child has no swap slot of the page, so if the page differs
+     from its area the child must write it out when evicting it. */
+  dirty = (*pte & PTE_D)
+          || get_suppl_pte(&parent->suppl_page_table, uva) != NULL;
+  pagedir_set_dirty(child->pagedir, uva, dirty);
+  pagedir_share_cow(parent->pagedir, uva);
+
+  m->t = child;
+  m->uva = uva;
+  m->pte = pagedir_get_pte(child->pagedir, uva);
+  list_push_back(&vf->cow_maps, &m->elem);
+  return true;
+}
+
+/* Remove T's mapping at UVA from shared frame VF.  If T owns VF, its
+   first copy-on-write sharer becomes the owner.  Must be called with
+   vm_lock held. */
+static void
+frame_drop_mapping(struct vm_frame *vf, struct thread *t, void *uva)
+{
+  struct list_elem *e;
+  struct cow_map *m;
+
+  if (vf->tid == t->tid && vf->uva == uva)
+    {
+      ASSERT(!list_empty(&vf->cow_maps));
+      m = list_entry(list_pop_front(&vf->cow_maps), struct cow_map, elem);
+      t->frame_cnt--;
+      m->t->frame_cnt++;
+      vf->tid = m->t->tid;
+      vf->uva = m->uva;
+      vf->pte = m->pte;
+      free(m);
+      return;
+    }
+
+  for (e = list_begin(&vf->cow_maps); e != list_end(&vf->cow_maps);
+       e = list_next(e))
+    {
+      m = list_entry(e, struct cow_map, elem);
+      if (m->t == t && m->uva == uva)
+        {
+          list_remove(e);
+          free(m);
+          return;
+        }
+    }
+}
+
+/* Give up the frames of exiting process T.  Frames it shares
+   copy-on-write go to the remaining sharers.  Frames it maps alone
+   are freed here, since pagedir_destroy() skips those still marked
+   copy-on-write.
+
+   With REAP, T has been killed by the OOM killer but may still be
+   in the kernel: it keeps the frames a system call has pinned and
+   loses its mappings of the rest, so that touching one faults and
+   finishes it off.  Must be called with eviction_lock and vm_lock
+   held. */
+static void
+release_frames(struct thread *t, bool reap)
+{
+  struct list_elem *e, *next;
+
+  for (e = list_begin(&vm_frames); e != list_end(&vm_frames); e = next)
+    {
+      struct vm_frame *vf = list_entry(e, struct vm_frame, elem);
+      struct list_elem *m, *m_next;
+      void *uva = vf->uva;
+
+      next = list_next(e);
+      if (reap && (vf->pin_cnt > 0 || vf->pagecached))
+        continue;
+      for (m = list_begin(&vf->cow_maps); m != list_end(&vf->cow_maps);
+           m = m_next)
+        {
+          struct cow_map *cm = list_entry(m, struct cow_map, elem);
+          m_next = list_next(m);
+          if (cm->t == t)
+            {
+              if (reap)
+                pagedir_clear_page(t->pagedir, cm->uva);
+              list_remove(m);
+              free(cm);
+            }
+        }
+
+      if (vf->tid != t->tid || uva == NULL)
+        continue;
+      if (!list_empty(&vf->cow_maps))
+        {
+          frame_drop_mapping(vf, t, uva);
+          if (reap)
+            pagedir_clear_page(t->pagedir, uva);
+        }
+      else if (pagedir_get_page(t->pagedir, uva) == vf->frame)
+        {
+          pagedir_clear_page(t->pagedir, uva);
+          list_remove(e);
+          frame_cnt--;
+          t->frame_cnt--;
+          palloc_free_page(vf->frame);
+          free(vf);
+        }
+    }
+}
+
+/* Sum of the allotments of the processes that are not suspended.
+   Must be called with pff_lock held. */
+static size_t
+running_quota(void)
+{
+  struct list_elem *e;
+  size_t sum = 0;
+
+  for (e = list_begin(&vm_procs); e != list_end(&vm_procs); e = list_next(e))
+    {
+      struct thread *p = list_entry(e, struct thread, vm_elem);
+      if (!p->suspended)
+        sum += p->frame_quota;
+    }
+  return sum;
+}
+
+/* Memory is overcommitted when the running processes' allotments
+   add up to more frames than there are: suspend the lowest-priority
+   processes until they fit, always leaving one running.
+   Must be called with pff_lock held. */
+static void
+load_control_suspend(void)
+{
+  if (frame_capacity == 0)
+    return;
+
+  while (running_quota() > frame_capacity)
+    {
+      struct list_elem *e;
+      struct thread *victim = NULL;
+      int running = 0;
+
+      for (e = list_begin(&vm_procs); e != list_end(&vm_procs);
+           e = list_next(e))
+        {
+          struct thread *p = list_entry(e, struct thread, vm_elem);
+          if (p->suspended)
+            continue;
+          running++;
+          if (victim == NULL || p->priority < victim->priority
+              || (p->priority == victim->priority
+                  && p->frame_quota > victim->frame_quota))
+            victim = p;
+        }
+      if (running <= 1)
+        break;
+
+      victim->suspended = true;
+      victim->suspended_at = timer_ticks();
+    }
+}
+
+/* Let the highest-priority suspended processes run again for as long
+   as their allotments fit.  Must be called with pff_lock held. */
+static void
+load_control_resume(void)
+{
+  for (;;)
+    {
+      struct list_elem *e;
+      struct thread *best = NULL;
+
+      for (e = list_begin(&vm_procs); e != list_end(&vm_procs);
+           e = list_next(e))
+        {
+          struct thread *p = list_entry(e, struct thread, vm_elem);
+          if (p->suspended
+              && (best == NULL || p->priority > best->priority))
+            best = p;
+        }
+      if (best == NULL)
+        break;
+
+      size_t running = running_quota();
+      if (running > 0 && running + best->frame_quota > frame_capacity)
+        break;
+      best->suspended = false;
+    }
+}
+
 /* Add a frame to the frame table. */
 static bool
 add_vm_frame(void *frame)
@@ -213,9 +1485,12 @@ add_vm_frame(void *frame)
 
   vf->tid = thread_current()->tid;
   vf->frame = frame;
+  list_init(&vf->cow_maps);
   
   lock_acquire(&vm_lock);
   list_push_back(&vm_frames, &vf->elem);
+  frame_cnt++;
+  thread_current()->frame_cnt++;
   lock_release(&vm_lock);
 
   return true;
@@ -235,6 +1510,10 @@ remove_vm_frame(void *frame)
       vf = list_entry(e, struct vm_frame, elem);
       if (vf->frame == frame)
         {
+          struct thread *t = thread_get_by_id(vf->tid);
+          if (t != NULL)
+            t->frame_cnt--;
+          frame_cnt--;
           list_remove(e);
           free(vf);
           break;
@@ -248,18 +1527,26 @@ static struct vm_frame *
 get_vm_frame(void *frame)
 {
   struct vm_frame *vf;
-  struct list_elem *e;
   
   lock_acquire(&vm_lock);
+  vf = find_vm_frame(frame);
+  lock_release(&vm_lock);
+
+  return vf;
+}
+
+/* Look up the vm_frame of a frame address, with vm_lock held. */
+static struct vm_frame *
+find_vm_frame(void *frame)
+{
+  struct list_elem *e;
+
   e = list_head(&vm_frames);
   while ((e = list_next(e)) != list_tail(&vm_frames))
     {
-      vf = list_entry(e, struct vm_frame, elem);
+      struct vm_frame *vf = list_entry(e, struct vm_frame, elem);
       if (vf->frame == frame)
-        break;
-      vf = NULL;
+        return vf;
     }
-  lock_release(&vm_lock);
-
-  return vf;
+  return NULL;
 }
@@ -2,6 +2,16 @@
 #define VM_FRAME_H
 
 #include "threads/thread.h"
+#include "threads/palloc.h"
+
+/* A mapping of a frame by a process other than its owner, made when
+   fork() shares the frame copy-on-write. */
+struct cow_map {
+  struct thread *t;      /* Process mapping the frame. */
+  void *uva;             /* User virtual address it is mapped at. */
+  uint32_t *pte;         /* Page table entry of the mapping. */
+  struct list_elem elem; /* List element in the frame's cow_maps. */
+};
 
 /* Struct representing a frame in memory, associated with a thread, 
    a page table entry (PTE), and a user virtual address (UVA). */
@@ -10,9 +20,40 @@ struct vm_frame {
   tid_t tid;             /* Thread ID owning the frame. */
   uint32_t *pte;         /* Page table entry linked to the frame. */
   void *uva;             /* User virtual address associated with the frame. */
+  bool readahead;        /* Filled by swap readahead and not yet used. */
+  bool pagecached;       /* Holds a page shared through the page cache. */
+  int pin_cnt;           /* Pins held by system calls; never evicted while set. */
+  struct list cow_maps;  /* Copy-on-write sharers besides the owner. */
+  bool merged;           /* Holds pages merged by the KSM scanner. */
+  unsigned ksm_round;    /* Last scanner round that visited the frame. */
+  unsigned ksm_sum;      /* Checksum the scanner saw last. */
   struct list_elem elem; /* List element for the frame table. */
 };
 
+/* Page-fault-frequency control of per-process frame allotments.
+   A process faulting more often than every PFF_GROW_TICKS is given
+   PFF_GROW_STEP more frames; one that goes PFF_TRIM_TICKS without a
+   fault has its allotment cut by a quarter.  A process that has used
+   up its allotment replaces its own pages.  When the allotments of
+   running processes no longer fit in memory, the lowest-priority
+   process is suspended the next time it would return to user mode,
+   and its frames are evicted first, for at most
+   PFF_SUSPEND_MAX_TICKS. */
+#define PFF_MIN_FRAMES 8          /* Smallest allotment. */
+#define PFF_INITIAL_FRAMES 32     /* Allotment of a new process. */
+#define PFF_GROW_STEP 4           /* Frames added on a frequent fault. */
+#define PFF_GROW_TICKS 10         /* Faults closer than this grow. */
+#define PFF_TRIM_TICKS 50         /* Faults farther apart than this trim. */
+#define PFF_SUSPEND_TICKS 10      /* Suspended processes recheck this often. */
+#define PFF_SUSPEND_MAX_TICKS 500 /* Longest suspension. */
+
+/* When no frame can be evicted, allocation waits OOM_THROTTLE_TICKS
+   at a time for memory to be freed.  After OOM_THROTTLE_TRIES waits
+   the OOM killer picks a victim; after as many more, the allocating
+   process gives up and is killed itself. */
+#define OOM_THROTTLE_TICKS 5
+#define OOM_THROTTLE_TRIES 10
+
 /* Global list to manage frames in the system. */
 struct list vm_frames;
 
@@ -22,14 +63,91 @@ void vm_frame_init (void);
 /* Allocates a new frame with the specified flags. */
 void *vm_allocate_frame (enum palloc_flags flags);
 
+/* Allocates a new frame only if one is free, never evicting. */
+void *vm_try_allocate_frame (enum palloc_flags flags);
+
 /* Frees the given frame and removes it from the frame table. */
 void vm_free_frame (void *frame);
 
 /* Links a frame to a user process's page table and virtual address. */
 void vm_frame_set_usr (void *frame, uint32_t *pte, void *uva);
 
+/* Marks a frame as speculatively filled by swap readahead. */
+void vm_frame_mark_readahead (void *frame);
+
+/* Marks a frame as holding a page of the page cache, so that the
+   frame table can tell without taking the page cache's lock. */
+void vm_frame_mark_pagecached (void *frame);
+
+/* Starts and stops frame accounting for user process T.  On exit,
+   T's frames are freed, or handed to the processes sharing them. */
+void vm_frame_process_init (struct thread *t);
+void vm_frame_process_exit (struct thread *t);
+
+/* Gives CHILD, just forked from PARENT, a copy of PARENT's pages:
+   resident frames are shared copy-on-write, swapped pages are copied
+   to new slots.  PARENT must not run meanwhile.  Returns false if
+   memory or swap ran out. */
+bool vm_frame_fork (struct thread *parent, struct thread *child);
+
+/* Resolves a write by T to UPAGE, mapped copy-on-write to a frame
+   shared by fork().  Returns false if memory ran out. */
+bool vm_frame_cow (struct thread *t, void *upage);
+
+/* Feeds a page fault of the current process to the PFF controller.
+   Returns false if the OOM killer has picked the process. */
+bool vm_frame_pff_fault (void);
+
+/* Sleeps while load control keeps the current process suspended.
+   Called only on the way back to user mode. */
+void vm_frame_load_control (void);
+
+/* Faults in the pages of the current process's buffer of SIZE bytes
+   at UADDR, writable if WRITE, and pins their frames so they stay
+   resident.  Returns false, pinning nothing, if the buffer is not
+   valid user memory. */
+bool vm_frame_pin_buffer (const void *uaddr, size_t size, bool write);
+
+/* Pins the pages of the null-terminated user string STR.  Returns
+   the size of the string including the terminator, to pass to
+   vm_frame_unpin_buffer(), or 0 if STR is not valid user memory. */
+size_t vm_frame_pin_string (const char *str);
+
+/* Releases the pins of a buffer pinned by one of the above. */
+void vm_frame_unpin_buffer (const void *uaddr, size_t size);
+
+/* Returns the score the OOM killer ranks process T by: the frames
+   it holds plus the swap slots its pages take up. */
+size_t vm_frame_oom_score (struct thread *t);
+
+/* Same-page merging support for the scanner in vm/ksm.c.  Only
+   private frames of writable areas other than mapped files are
+   candidates. */
+
+/* Stores in KPAGES up to MAX candidate frames not yet visited in
+   ROUND, and marks them visited.  Returns how many were stored. */
+size_t vm_frame_ksm_collect (void **kpages, size_t max, unsigned round);
+
+/* Checksums candidate frame KPAGE into *SUM.  Returns true if KPAGE
+   is still a candidate and its checksum has not changed since the
+   scanner last looked at it. */
+bool vm_frame_ksm_checksum (void *kpage, unsigned *sum);
+
+/* Merges frame DUP into frame KEEP if both are still candidates and
+   hold the same data: every mapping of DUP is moved to KEEP, copy-on-
+   write, and DUP is freed.  Returns true if the frames were merged. */
+bool vm_frame_merge (void *keep, void *dup);
+
+/* Counts the frames holding merged pages, in *SHARED, and the extra
+   mappings of those frames, in *SHARING. */
+void vm_frame_ksm_stats (size_t *shared, size_t *sharing);
+
+/* Prints how memory pressure has been relieved. */
+void vm_frame_print_stats (void);
+
 /* Selects a frame to evict, writes its content to swap or file if necessary, 
-   and makes the frame available for reuse. */
+   and makes the frame available for reuse.  Returns a null pointer if
+   no frame can be evicted. */
 void *evict_frame (void);
 
 #endif /* vm/frame.h */
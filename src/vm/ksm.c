@@ -0,0 +1,157 @@
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "vm/frame.h"
+
+#include "vm/ksm.h"
+
+/* A frame seen in the current round, by checksum. */
+struct ksm_node
+  {
+    unsigned sum;               /* Checksum of the frame's data. */
+    void *kpage;                /* The frame. */
+    struct hash_elem elem;      /* Element in `seen'. */
+  };
+
+size_t ksm_pages_to_scan;
+
+/* Frames seen in the current round, and the round's number.  Only
+   the scanner thread touches these. */
+static struct hash seen;
+static unsigned cur_round = 1;
+
+/* Frames collected for the current scan. */
+static void **batch;
+
+/* Statistics. */
+static unsigned long long scan_cnt;      /* Frames checksummed. */
+static unsigned long long merge_cnt;     /* Frames merged away. */
+static unsigned long long round_cnt;     /* Rounds completed. */
+
+static thread_func ksm_thread NO_RETURN;
+static void ksm_scan (void);
+static void ksm_visit (void *kpage, unsigned sum);
+static hash_hash_func node_hash;
+static hash_less_func node_less;
+static hash_action_func node_free;
+
+void
+ksm_init (void)
+{
+  if (ksm_pages_to_scan == 0)
+    return;
+
+  batch = malloc (ksm_pages_to_scan * sizeof *batch);
+  if (batch == NULL || !hash_init (&seen, node_hash, node_less, NULL))
+    PANIC ("ksm: out of memory");
+  thread_create ("ksm", PRI_MIN, ksm_thread, NULL);
+}
+
+void
+ksm_print_stats (void)
+{
+  size_t shared, sharing;
+
+  if (ksm_pages_to_scan == 0)
+    return;
+
+  vm_frame_ksm_stats (&shared, &sharing);
+  printf ("KSM: %llu frames scanned in %llu rounds, %llu merged; "
+          "%zu frames shared by %zu merged pages\n",
+          scan_cnt, round_cnt, merge_cnt, shared, sharing);
+}
+
+/* Scans at the configured rate, forever. */
+static void
+ksm_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (KSM_SCAN_TICKS);
+      ksm_scan ();
+    }
+}
+
+/* Checksums the next batch of frames of the current round.  Once
+   every frame has been visited, starts a new round with nothing
+   seen: frames change, so what was seen goes stale. */
+static void
+ksm_scan (void)
+{
+  size_t cnt, i;
+
+  cnt = vm_frame_ksm_collect (batch, ksm_pages_to_scan, cur_round);
+  if (cnt == 0)
+    {
+      hash_clear (&seen, node_free);
+      cur_round++;
+      round_cnt++;
+      cnt = vm_frame_ksm_collect (batch, ksm_pages_to_scan, cur_round);
+    }
+
+  for (i = 0; i < cnt; i++)
+    {
+      unsigned sum;
+
+      scan_cnt++;
+      if (vm_frame_ksm_checksum (batch[i], &sum))
+        ksm_visit (batch[i], sum);
+    }
+}
+
+/* KPAGE's data has checksum SUM and has not changed lately: merge it
+   into the frame seen with the same checksum, or remember it. */
+static void
+ksm_visit (void *kpage, unsigned sum)
+{
+  struct ksm_node key, *node;
+  struct hash_elem *e;
+
+  key.sum = sum;
+  e = hash_find (&seen, &key.elem);
+  if (e == NULL)
+    {
+      node = malloc (sizeof *node);
+      if (node == NULL)
+        return;
+      node->sum = sum;
+      node->kpage = kpage;
+      hash_insert (&seen, &node->elem);
+      return;
+    }
+
+  node = hash_entry (e, struct ksm_node, elem);
+  if (node->kpage == kpage)
+    return;
+  if (vm_frame_merge (node->kpage, kpage))
+    merge_cnt++;
+  else
+    {
+      /* The frame seen before changed, went away, or only shares the
+         checksum: the newer frame is the better bet. */
+      node->kpage = kpage;
+    }
+}
+
+static unsigned
+node_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_entry (e, struct ksm_node, elem)->sum;
+}
+
+static bool
+node_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  return (hash_entry (a, struct ksm_node, elem)->sum
+          < hash_entry (b, struct ksm_node, elem)->sum);
+}
+
+static void
+node_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct ksm_node, elem));
+}
@@ -0,0 +1,28 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+
+#include <stddef.h>
+
+/* Same-page merging.
+
+   A low-priority kernel thread wakes up every KSM_SCAN_TICKS and
+   checksums up to ksm_pages_to_scan private user frames.  A frame
+   whose checksum has not changed since the scanner last saw it is
+   looked up by checksum among the frames seen so far in the current
+   round over the frame table, and merged with an equal one: both
+   processes then map a single read-only copy-on-write frame, and
+   the other frame is freed.  A write to a merged page faults and
+   gets the writer a copy again, as after fork(). */
+
+#define KSM_SCAN_TICKS 20       /* Ticks between scans. */
+
+/* Frames checksummed per scan, set with -ksm; 0 disables merging. */
+extern size_t ksm_pages_to_scan;
+
+/* Starts the scanner thread, if enabled. */
+void ksm_init (void);
+
+/* Prints merging statistics. */
+void ksm_print_stats (void);
+
+#endif /* vm/ksm.h */
@@ -8,15 +8,30 @@
 #include "string.h"
 #include "userprog/syscall.h"
 #include "vm/swap.h"
+#include "vm/pagecache.h"
 
 /* Helper functions for loading page types and cleaning up */
-static bool load_page_file(struct suppl_pte *);
-static bool load_page_swap(struct suppl_pte *);
+static bool load_page_file(struct vm_area *, void *);
+static void finish_swap_in(struct suppl_pte *);
+static void swap_readahead(struct thread *, void *, size_t);
+static void file_fault_around(struct thread *, struct vm_area *, void *);
+static bool map_file_page(struct thread *, struct vm_area *, void *, bool);
+static bool map_anon_page(struct thread *, void *, bool);
+static bool read_file_page(struct vm_area *, void *, uint8_t *);
+static void readahead_adapt(int *, unsigned *, unsigned *, int, int);
+static bool install_user_frame(struct thread *, void *, void *, bool);
 static void free_suppl_pte(struct hash_elem *, void * UNUSED);
 
-/* Initialize supplemental page table management (currently no-op). */
+/* Upper bound on pages mapped around a file-backed fault. */
+int fault_around_max = FAULT_AROUND_DEFAULT;
+
+/* A frame of zeros, mapped copy-on-write for every page that starts
+   out zero-filled until the process writes to it. */
+static void *zero_page;
+
+/* Initialize supplemental page table management. */
 void vm_page_init(void) {
-  return;
+  zero_page = palloc_get_page(PAL_ZERO | PAL_ASSERT);
 }
 
 /* Hash function for supplemental page table. */
@@ -39,68 +54,247 @@ struct suppl_pte *get_suppl_pte(struct hash *ht, void *uvaddr) {
   return e != NULL ? hash_entry(e, struct suppl_pte, elem) : NULL;
 }
 
-/* Load the page described by the supplemental page table entry. */
-bool load_page(struct suppl_pte *spte) {
-  switch (spte->type) {
-    case FILE:
-      return load_page_file(spte);
-    case SWAP:
-      return load_page_swap(spte);
-    default:
-      return false;
-  }
+/* Load the page at UPAGE of VMA, which has never been swapped out:
+   from its file, or as zeros.  WRITE tells whether the fault was a
+   write. */
+bool load_page_vma(struct vm_area *vma, void *upage, bool write) {
+  struct thread *cur = thread_current();
+
+  if (vma_is_file(vma))
+    return load_page_file(vma, upage);
+  return map_anon_page(cur, upage, write);
 }
 
-/* Load a file-backed page into memory. */
-static bool load_page_file(struct suppl_pte *spte) {
+/* Load a file-backed page into memory, then map the following pages
+   of the same area around it. */
+static bool load_page_file(struct vm_area *vma, void *upage) {
   struct thread *cur = thread_current();
 
-  file_seek(spte->data.file_page.file, spte->data.file_page.ofs);
+  if (!map_file_page(cur, vma, upage, false)) return false;
 
-  uint8_t *kpage = vm_allocate_frame(PAL_USER); // Allocate a frame.
+  file_fault_around(cur, vma, upage);
+  return true;
+}
+
+/* Bring page UPAGE of VMA into a frame and map it in T.  Read-only
+   pages go through the page cache, so every process running the same
+   executable maps one frame.  A SPECULATIVE load only uses a free
+   frame, and marks it as readahead if it had to read the page. */
+static bool map_file_page(struct thread *t, struct vm_area *vma, void *upage, bool speculative) {
+  struct inode *inode = file_get_inode(vma->file);
+  off_t ofs = vma_page_ofs(vma, upage);
+  uint32_t read_bytes = vma_page_read_bytes(vma, upage);
+  bool shared = !vma->writable;
+  uint8_t *kpage;
+
+  /* BSS and other all-zero pages cost nothing until written. */
+  if (read_bytes == 0)
+    return pagedir_set_page_cow(t->pagedir, upage, zero_page);
+
+  if (shared && pagecache_install(inode, ofs, read_bytes, NULL, t, upage) != NULL)
+    return true;
+
+  kpage = speculative ? vm_try_allocate_frame(PAL_USER) : vm_allocate_frame(PAL_USER);
   if (kpage == NULL) return false;
 
-  if (file_read(spte->data.file_page.file, kpage, spte->data.file_page.read_bytes)
-      != (int)spte->data.file_page.read_bytes) {
+  if (!read_file_page(vma, upage, kpage)) {
     vm_free_frame(kpage);
     return false;
   }
 
-  memset(kpage + spte->data.file_page.read_bytes, 0, spte->data.file_page.zero_bytes);
-
-  if (!pagedir_set_page(cur->pagedir, spte->uvaddr, kpage, spte->data.file_page.writable)) {
+  if (shared) {
+    /* Another process may have cached the page while we were reading. */
+    void *mapped = pagecache_install(inode, ofs, read_bytes, kpage, t, upage);
+    if (mapped != kpage) {
+      vm_free_frame(kpage);
+      if (mapped == NULL) return false;
+      kpage = NULL;
+    }
+  } else if (!install_user_frame(t, upage, kpage, true)) {
     vm_free_frame(kpage);
     return false;
   }
 
-  spte->is_loaded = true;
+  if (speculative && kpage != NULL) vm_frame_mark_readahead(kpage);
+  return true;
+}
+
+/* Fill KPAGE with the file contents of page UPAGE of VMA and zero the
+   rest. */
+static bool read_file_page(struct vm_area *vma, void *upage, uint8_t *kpage) {
+  uint32_t read_bytes = vma_page_read_bytes(vma, upage);
+
+  if (file_read_at(vma->file, kpage, read_bytes, vma_page_ofs(vma, upage))
+      != (int)read_bytes)
+    return false;
+
+  memset(kpage + read_bytes, 0, PGSIZE - read_bytes);
+  return true;
+}
+
+/* Map the not-yet-loaded pages that follow UPAGE in VMA, up to the
+   area's fault-around window, so a sequential walk over an area takes
+   one fault per window instead of one per page.  Only free frames are
+   used: fault-around never evicts. */
+static void file_fault_around(struct thread *t, struct vm_area *vma, void *upage) {
+  int i;
+
+  readahead_adapt(&vma->fault_around, &vma->ra_hits, &vma->ra_misses,
+                  1, fault_around_max);
+
+  for (i = 1; i <= vma->fault_around; i++) {
+    uint8_t *next_page = (uint8_t *) upage + i * PGSIZE;
+    if (next_page >= vma->end) break;
+
+    /* Stop at pages already mapped, or whose contents are in swap. */
+    if (pagedir_get_page(t->pagedir, next_page) != NULL
+        || get_suppl_pte(&t->suppl_page_table, next_page) != NULL)
+      break;
+
+    if (!map_file_page(t, vma, next_page, true)) break;
+  }
+}
+
+/* Map zero-filled page UPAGE in T: the shared zero page until the
+   first WRITE, a frame of its own after that. */
+static bool map_anon_page(struct thread *t, void *upage, bool write) {
+  void *kpage;
+
+  if (!write)
+    return pagedir_set_page_cow(t->pagedir, upage, zero_page);
+
+  kpage = vm_allocate_frame(PAL_USER | PAL_ZERO); // Allocate zeroed frame.
+  if (kpage == NULL) return false;
+
+  if (!install_user_frame(t, upage, kpage, true)) {
+    vm_free_frame(kpage);
+    return false;
+  }
   return true;
 }
 
-/* Load a swapped page into memory. */
-static bool load_page_swap(struct suppl_pte *spte) {
+/* Load a swapped page into memory, then read ahead the pages that were
+   swapped out next to it. */
+bool load_page(struct suppl_pte *spte) {
+  struct thread *cur = thread_current();
+  void *upage = spte->uvaddr;
+  size_t slot = spte->swap_slot_idx;
+
   uint8_t *kpage = vm_allocate_frame(PAL_USER); // Allocate a frame.
   if (kpage == NULL) return false;
 
-  if (!pagedir_set_page(thread_current()->pagedir, spte->uvaddr, kpage, spte->swap_writable)) {
+  swap_read_slot(slot, kpage); // Swap data into memory.
+
+  if (!install_user_frame(cur, upage, kpage, spte->swap_writable)) {
     vm_free_frame(kpage);
     return false;
   }
 
-  swap_to_page(spte->swap_slot_idx, spte->uvaddr); // Swap data into memory.
+  finish_swap_in(spte);
+  swap_readahead(cur, upage, slot);
+  return true;
+}
+
+/* Mark SPTE resident again.  A swap device slot is kept as a swap
+   cache: while the page stays clean the slot still holds its
+   contents, so evicting it again only has to drop the mapping.  The
+   slot is given up when a dirty eviction rewrites it, when swap runs
+   full, or when the process exits.  A copy in the compressed RAM
+   tier is freed at once instead, since it would hold pool memory
+   for a page that is resident anyway; the page is marked dirty so
+   that it is saved again when evicted.  SPTE is freed with it. */
+static void finish_swap_in(struct suppl_pte *spte) {
+  struct thread *cur = thread_current();
+
+  spte->is_loaded = true;
+  cur->swapped_cnt--;
+
+  if (swap_slot_in_ram(spte->swap_slot_idx)) {
+    swap_clean_slot(spte->swap_slot_idx);
+    pagedir_set_dirty(cur->pagedir, spte->uvaddr, true);
+    hash_delete(&cur->suppl_page_table, &spte->elem);
+    free(spte);
+  }
+}
+
+/* Speculatively load the pages above UPAGE whose swap slots directly
+   follow SLOT, up to T's readahead window.  Eviction places a process's
+   neighbouring pages in neighbouring slots, so these reads are
+   sequential on disk.  Only free frames are used: readahead never
+   evicts anything to make room. */
+static void swap_readahead(struct thread *t, void *upage, size_t slot) {
+  int i;
+
+  readahead_adapt(&t->swap_ra_window, &t->swap_ra_hits, &t->swap_ra_misses,
+                  SWAP_RA_MIN, SWAP_RA_MAX);
+
+  for (i = 1; i <= t->swap_ra_window; i++) {
+    void *next_page = (uint8_t *) upage + i * PGSIZE;
+    if (!is_user_vaddr(next_page)) break;
+
+    struct suppl_pte *next = get_suppl_pte(&t->suppl_page_table, next_page);
+    if (next == NULL || next->is_loaded || next->swap_slot_idx != slot + i)
+      break;
+
+    uint8_t *kpage = vm_try_allocate_frame(PAL_USER);
+    if (kpage == NULL) break;
+
+    swap_read_slot(next->swap_slot_idx, kpage);
+    if (!install_user_frame(t, next_page, kpage, next->swap_writable)) {
+      vm_free_frame(kpage);
+      break;
+    }
+
+    vm_frame_mark_readahead(kpage);
+    finish_swap_in(next);
+  }
+}
+
+/* Resize a readahead WINDOW from the outcomes counted in HITS and
+   MISSES since the last resize: double it while at least 3/4 of the
+   speculative pages get used, halve it when fewer than half do.  The
+   result is kept within [MIN, MAX]. */
+static void readahead_adapt(int *window, unsigned *hits, unsigned *misses, int min, int max) {
+  unsigned total = *hits + *misses;
+
+  if (total >= RA_SAMPLE) {
+    if (*hits * 4 >= total * 3)
+      *window *= 2;
+    else if (*hits * 2 < total)
+      *window /= 2;
+    *hits = *misses = 0;
+  }
 
-  if (spte->type == SWAP) {
-    hash_delete(&thread_current()->suppl_page_table, &spte->elem); // Remove swap entry.
-  } else if (spte->type == (FILE | SWAP)) {
-    spte->type = FILE;
-    spte->is_loaded = true;
+  if (*window < min) *window = min;
+  if (*window > max) *window = max;
+}
+
+/* Credit the speculative page of T at UVA as USED or wasted, to the
+   area it was faulted around in or else to T's swap readahead. */
+void vm_page_readahead_outcome(struct thread *t, void *uva, bool used) {
+  struct vm_area *vma = vma_find(t, uva);
+
+  if (vma != NULL && vma_is_file(vma)
+      && get_suppl_pte(&t->suppl_page_table, uva) == NULL) {
+    if (used) vma->ra_hits++;
+    else vma->ra_misses++;
+  } else {
+    if (used) t->swap_ra_hits++;
+    else t->swap_ra_misses++;
   }
+}
 
+/* Map UPAGE to frame KPAGE in T's page directory and record the
+   mapping in the frame table so the frame can be evicted later. */
+static bool install_user_frame(struct thread *t, void *upage, void *kpage, bool writable) {
+  if (!pagedir_set_page(t->pagedir, upage, kpage, writable)) return false;
+
+  vm_frame_set_usr(kpage, pagedir_get_pte(t->pagedir, upage), upage);
   return true;
 }
 
 /* Free all entries in a supplemental page table. */
-static void free_suppl_pt(struct hash *suppl_pt) {
+void free_suppl_pt(struct hash *suppl_pt) {
   hash_destroy(suppl_pt, free_suppl_pte);
 }
 
@@ -108,7 +302,7 @@ static void free_suppl_pt(struct hash *suppl_pt) {
 void free_suppl_pte(struct hash_elem *e, void *aux UNUSED) {
   struct suppl_pte *spte = hash_entry(e, struct suppl_pte, elem);
 
-  if (spte->type & SWAP) swap_clean_slot(spte->swap_slot_idx);
+  swap_clean_slot(spte->swap_slot_idx);
 
   free(spte);
 }
@@ -121,43 +315,72 @@ bool insert_suppl_pte(struct hash *spt, struct suppl_pte *spte) {
   return result == NULL;
 }
 
-/* Add a file-backed entry to the supplemental page table. */
-bool suppl_pt_insert_file(struct file *file, off_t ofs, uint8_t *upage,
-                          uint32_t read_bytes, uint32_t zero_bytes, bool writable) {
-  struct suppl_pte *spte = calloc(1, sizeof *spte);
-  if (spte == NULL) return false;
+/* Grow the stack area down to the page of UVADDR and map that page.
+   A page first touched by a read maps the zero page and only gets a
+   frame when written.  Returns false if the stack cannot grow that
+   far or memory ran out. */
+bool grow_stack(void *uvaddr, bool write) {
+  struct thread *t = thread_current();
+  void *upage = pg_round_down(uvaddr);
 
-  spte->uvaddr = upage;
-  spte->type = FILE;
-  spte->data.file_page = (struct {
-    struct file *file;
-    off_t ofs;
-    uint32_t read_bytes;
-    uint32_t zero_bytes;
-    bool writable;
-  }){file, ofs, read_bytes, zero_bytes, writable};
-  spte->is_loaded = false;
-
-  struct hash_elem *result = hash_insert(&thread_current()->suppl_page_table, &spte->elem);
-  return result == NULL;
+  if (!vma_extend_stack(t, upage)) return false;
+
+  return map_anon_page(t, upage, write);
 }
 
-/* Grow the stack by adding a page. */
-void grow_stack(void *uvaddr) {
+/* Handle a write to the copy-on-write page containing UVADDR by
+   giving the current process its own writable copy, of the zero page
+   or of a frame shared by fork().  Returns false if the page is not
+   copy-on-write or the process may not write it. */
+bool vm_page_cow(void *uvaddr) {
   struct thread *t = thread_current();
-  void *spage = vm_allocate_frame(PAL_USER | PAL_ZERO); // Allocate zeroed frame.
+  void *upage = pg_round_down(uvaddr);
+  struct vm_area *vma;
+  void *kpage, *copy;
 
-  if (spage == NULL) return;
+  if (!pagedir_is_cow(t->pagedir, upage)) return false;
 
-  if (!pagedir_set_page(t->pagedir, pg_round_down(uvaddr), spage, true)) {
-    vm_free_frame(spage);
-  }
-}
+  vma = vma_find(t, upage);
+  if (vma == NULL || !vma->writable)
+    return false;
 
+  kpage = pagedir_get_page(t->pagedir, upage);
+  if (kpage != zero_page) return vm_frame_cow(t, upage);
 
+  copy = vm_allocate_frame(PAL_USER | PAL_ZERO);
+  if (copy == NULL) return false;
 
+  pagedir_clear_page(t->pagedir, upage);
+  if (!install_user_frame(t, upage, copy, true)) {
+    vm_free_frame(copy);
+    return false;
+  }
+  return true;
+}
 
+/* Make sure page UPAGE of the current process is mapped, and writable
+   if WRITE, loading it the way a page fault would.  Returns false if
+   the process has no such page, or may not write it. */
+bool vm_page_fault_in(void *upage, bool write) {
+  struct thread *t = thread_current();
+  struct suppl_pte *spte;
+  struct vm_area *vma;
 
+  if (!is_user_vaddr(upage)) return false;
 
+  vma = vma_find(t, upage);
+  if (write && (vma == NULL || !vma->writable)) return false;
 
+  if (pagedir_get_page(t->pagedir, upage) == NULL) {
+    spte = get_suppl_pte(&t->suppl_page_table, upage);
+    if (spte != NULL && !spte->is_loaded) {
+      if (!load_page(spte)) return false;
+    } else if (vma != NULL) {
+      if (!load_page_vma(vma, upage, write)) return false;
+    } else
+      return false;
+  }
 
+  if (write && pagedir_is_cow(t->pagedir, upage)) return vm_page_cow(upage);
+  return true;
+}
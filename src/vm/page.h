@@ -3,32 +3,30 @@
 
 #define STACK_SIZE (8 * (1 << 20)) // Maximum stack size: 8 MB.
 
+#define SWAP_RA_MIN 1     // Smallest swap readahead window, in pages.
+#define SWAP_RA_MAX 16    // Largest swap readahead window, in pages.
+#define RA_SAMPLE 8       // Readahead outcomes between window resizes.
+#define FAULT_AROUND_DEFAULT 8 // Default bound on file fault-around, in pages.
+
+/* Upper bound on pages mapped around a file-backed fault (-fault-around). */
+extern int fault_around_max;
+
 #include <stdio.h>
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "lib/kernel/hash.h"
 #include "filesys/file.h"
+#include "vm/vma.h"
 
 /* Supplemental Page Table Management */
 
-/* Page types:
-   - SWAP: Stored in swap space.
-   - FILE: File-backed.
-   - MMF: Memory-mapped file. */
-enum suppl_pte_type
-{
-  SWAP = 001,
-  FILE = 002,
-  MMF  = 004
-};
-
-/* An entry in the supplemental page table. */
+/* Per-page state of a page that has been written to swap.  Pages
+   that never went to swap have no entry: what they hold comes from
+   the virtual memory area they are in. */
 struct suppl_pte
 {
   void *uvaddr;             // Virtual address (unique key).
-  enum suppl_pte_type type; // Page type.
-  union suppl_pte_data data;// Type-specific data.
-  bool is_loaded;           // Whether the page is loaded.
+  bool is_loaded;           // Resident, the slot kept as swap cache.
 
   /* Swap information */
   size_t swap_slot_idx;     // Swap slot index.
@@ -37,20 +35,6 @@ struct suppl_pte
   struct hash_elem elem;    // Hash table element.
 };
 
-/* Stores page-specific data:
-   - For file-backed pages, includes file, offsets, and size. */
-union suppl_pte_data
-{
-  struct
-  {
-    struct file *file;       // File associated with the page.
-    off_t ofs;               // File offset.
-    uint32_t read_bytes;     // Bytes to read.
-    uint32_t zero_bytes;     // Bytes to zero-fill.
-    bool writable;           // Writable flag.
-  } file_page;
-};
-
 /* Initialize supplemental page table management. */
 void vm_page_init(void);
 
@@ -61,19 +45,28 @@ bool suppl_pt_less(const struct hash_elem *, const struct hash_elem *, void *);
 /* Insert a supplemental page table entry. */
 bool insert_suppl_pte(struct hash *, struct suppl_pte *);
 
-/* Add a file-backed page to the table. */
-bool suppl_pt_insert_file(struct file *, off_t, uint8_t *, uint32_t, uint32_t, bool);
-
 /* Retrieve a supplemental page table entry by address. */
 struct suppl_pte *get_suppl_pte(struct hash *, void *);
 
 /* Free all entries in a supplemental page table. */
 void free_suppl_pt(struct hash *);
 
-/* Load a page into memory. */
+/* Load a swapped page into memory. */
 bool load_page(struct suppl_pte *);
 
-/* Expand the stack by adding a page. */
-void grow_stack(void *);
+/* Load a page of an area that has never been swapped out. */
+bool load_page_vma(struct vm_area *, void *, bool);
+
+/* Credit a readahead or fault-around page of T at UVA as used or wasted. */
+void vm_page_readahead_outcome(struct thread *, void *, bool);
+
+/* Expand the stack by adding a page, zero-mapped unless written. */
+bool grow_stack(void *, bool);
+
+/* Give the current process a private copy of a copy-on-write page. */
+bool vm_page_cow(void *);
+
+/* Make sure a page of the current process is mapped, as a fault would. */
+bool vm_page_fault_in(void *, bool);
 
 #endif /* vm/page.h */
\ No newline at end of file
@@ -0,0 +1,253 @@
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+
+#include "vm/pagecache.h"
+
+/* A read-only file page held in one frame by every process that
+   maps it. */
+struct cached_page
+  {
+    block_sector_t inumber;     /* Inode the page was read from. */
+    off_t ofs;                  /* Offset of the page in the inode. */
+    uint32_t read_bytes;        /* Bytes of file data, rest is zeros. */
+    void *kpage;                /* Frame holding the page. */
+    struct list mappings;       /* Every mapping of the frame. */
+    struct hash_elem key_elem;  /* Element in cached_pages. */
+    struct hash_elem frame_elem;/* Element in cached_frames. */
+  };
+
+/* One user mapping of a cached page. */
+struct cached_mapping
+  {
+    struct thread *t;           /* Process mapping the page. */
+    void *uva;                  /* Where it is mapped. */
+    struct cached_page *page;   /* Page mapped. */
+    struct list_elem page_elem; /* Element in the page's mappings. */
+    struct list_elem thread_elem;/* Element in T's shared_maps. */
+  };
+
+/* Cached pages, by (inode, offset, length) and by frame. */
+static struct hash cached_pages;
+static struct hash cached_frames;
+
+/* Protects both tables and all mapping lists. */
+static struct lock pagecache_lock;
+
+static unsigned cached_page_hash (const struct hash_elem *, void *);
+static bool cached_page_less (const struct hash_elem *,
+                              const struct hash_elem *, void *);
+static unsigned cached_frame_hash (const struct hash_elem *, void *);
+static bool cached_frame_less (const struct hash_elem *,
+                               const struct hash_elem *, void *);
+static struct cached_page *find_frame (void *);
+static bool add_mapping (struct cached_page *, struct thread *, void *);
+
+void
+pagecache_init (void)
+{
+  hash_init (&cached_pages, cached_page_hash, cached_page_less, NULL);
+  hash_init (&cached_frames, cached_frame_hash, cached_frame_less, NULL);
+  lock_init (&pagecache_lock);
+}
+
+void *
+pagecache_install (struct inode *inode, off_t ofs, uint32_t read_bytes,
+                   void *kpage, struct thread *t, void *uva)
+{
+  struct cached_page key, *cp;
+  struct hash_elem *e;
+  void *mapped = NULL;
+
+  key.inumber = inode_get_inumber (inode);
+  key.ofs = ofs;
+  key.read_bytes = read_bytes;
+
+  lock_acquire (&pagecache_lock);
+  e = hash_find (&cached_pages, &key.key_elem);
+  if (e != NULL)
+    {
+      /* Somebody already has the page: share their frame. */
+      cp = hash_entry (e, struct cached_page, key_elem);
+      if (add_mapping (cp, t, uva))
+        mapped = cp->kpage;
+    }
+  else if (kpage != NULL && (cp = malloc (sizeof *cp)) != NULL)
+    {
+      /* First copy in memory: KPAGE becomes the shared frame. */
+      *cp = key;
+      cp->kpage = kpage;
+      list_init (&cp->mappings);
+      if (add_mapping (cp, t, uva))
+        {
+          hash_insert (&cached_pages, &cp->key_elem);
+          hash_insert (&cached_frames, &cp->frame_elem);
+          vm_frame_set_usr (kpage, pagedir_get_pte (t->pagedir, uva), uva);
+          vm_frame_mark_pagecached (kpage);
+          mapped = kpage;
+        }
+      else
+        free (cp);
+    }
+  lock_release (&pagecache_lock);
+
+  return mapped;
+}
+
+bool
+pagecache_test_and_clear_accessed (void *kpage, struct pagedir_batch *batch)
+{
+  struct cached_page *cp;
+  struct list_elem *e;
+  bool accessed = false;
+
+  lock_acquire (&pagecache_lock);
+  cp = find_frame (kpage);
+  if (cp != NULL)
+    for (e = list_begin (&cp->mappings); e != list_end (&cp->mappings);
+         e = list_next (e))
+      {
+        struct cached_mapping *m = list_entry (e, struct cached_mapping,
+                                               page_elem);
+        if (pagedir_test_and_clear_accessed (m->t->pagedir, m->uva, batch))
+          accessed = true;
+      }
+  lock_release (&pagecache_lock);
+
+  return accessed;
+}
+
+void
+pagecache_evict (void *kpage)
+{
+  struct cached_page *cp;
+
+  lock_acquire (&pagecache_lock);
+  cp = find_frame (kpage);
+  if (cp != NULL)
+    {
+      while (!list_empty (&cp->mappings))
+        {
+          struct cached_mapping *m = list_entry (list_pop_front (&cp->mappings),
+                                                 struct cached_mapping,
+                                                 page_elem);
+          /* The page is read-only, hence clean: the file still has
+             it, so the sharer only needs to fault it back in. */
+          pagedir_clear_page (m->t->pagedir, m->uva);
+
+          list_remove (&m->thread_elem);
+          free (m);
+        }
+      hash_delete (&cached_pages, &cp->key_elem);
+      hash_delete (&cached_frames, &cp->frame_elem);
+      free (cp);
+    }
+  lock_release (&pagecache_lock);
+}
+
+void
+pagecache_drop_process (struct thread *t)
+{
+  lock_acquire (&pagecache_lock);
+  while (!list_empty (&t->shared_maps))
+    {
+      struct cached_mapping *m = list_entry (list_pop_front (&t->shared_maps),
+                                             struct cached_mapping,
+                                             thread_elem);
+      struct cached_page *cp = m->page;
+
+      /* Keep pagedir_destroy() from freeing a frame others still use. */
+      pagedir_clear_page (t->pagedir, m->uva);
+      list_remove (&m->page_elem);
+      free (m);
+
+      if (list_empty (&cp->mappings))
+        {
+          hash_delete (&cached_pages, &cp->key_elem);
+          hash_delete (&cached_frames, &cp->frame_elem);
+          vm_free_frame (cp->kpage);
+          free (cp);
+        }
+    }
+  lock_release (&pagecache_lock);
+}
+
+/* Maps CP's frame at UVA in T and records the mapping. */
+static bool
+add_mapping (struct cached_page *cp, struct thread *t, void *uva)
+{
+  struct cached_mapping *m = malloc (sizeof *m);
+
+  if (m == NULL)
+    return false;
+  if (!pagedir_set_page (t->pagedir, uva, cp->kpage, false))
+    {
+      free (m);
+      return false;
+    }
+
+  m->t = t;
+  m->uva = uva;
+  m->page = cp;
+  list_push_back (&cp->mappings, &m->page_elem);
+  list_push_back (&t->shared_maps, &m->thread_elem);
+  return true;
+}
+
+/* Returns the cached page held in KPAGE, if any.
+   Must be called with pagecache_lock held. */
+static struct cached_page *
+find_frame (void *kpage)
+{
+  struct cached_page key;
+  struct hash_elem *e;
+
+  key.kpage = kpage;
+  e = hash_find (&cached_frames, &key.frame_elem);
+  return e != NULL ? hash_entry (e, struct cached_page, frame_elem) : NULL;
+}
+
+static unsigned
+cached_page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cached_page *cp = hash_entry (e, struct cached_page, key_elem);
+  return hash_int (cp->inumber) ^ hash_int (cp->ofs) ^ cp->read_bytes;
+}
+
+static bool
+cached_page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                  void *aux UNUSED)
+{
+  const struct cached_page *a = hash_entry (a_, struct cached_page, key_elem);
+  const struct cached_page *b = hash_entry (b_, struct cached_page, key_elem);
+
+  if (a->inumber != b->inumber)
+    return a->inumber < b->inumber;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->read_bytes < b->read_bytes;
+}
+
+static unsigned
+cached_frame_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cached_page *cp = hash_entry (e, struct cached_page,
+                                             frame_elem);
+  return hash_bytes (&cp->kpage, sizeof cp->kpage);
+}
+
+static bool
+cached_frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                   void *aux UNUSED)
+{
+  const struct cached_page *a = hash_entry (a_, struct cached_page,
+                                            frame_elem);
+  const struct cached_page *b = hash_entry (b_, struct cached_page,
+                                            frame_elem);
+  return a->kpage < b->kpage;
+}
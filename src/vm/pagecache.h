@@ -0,0 +1,44 @@
+#ifndef VM_PAGECACHE_H
+#define VM_PAGECACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "filesys/inode.h"
+#include "filesys/off_t.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+
+/* Page cache of read-only file pages.
+
+   Processes running the same executable map its read-only pages
+   from a single frame, found by (inode, offset).  Each cached page
+   remembers every mapping of it, so that eviction can unmap it
+   from all sharers at once. */
+
+/* Initializes the page cache. */
+void pagecache_init (void);
+
+/* Maps the cached frame for READ_BYTES bytes of INODE at OFS at
+   UVA in T, read-only.  If no frame is cached and KPAGE is not
+   null, KPAGE (already filled, in the frame table) becomes the
+   cached frame.  Returns the mapped frame, or a null pointer if
+   nothing was cached and KPAGE is null, or if mapping failed. */
+void *pagecache_install (struct inode *, off_t ofs, uint32_t read_bytes,
+                         void *kpage, struct thread *t, void *uva);
+
+/* Returns true if any mapping of the shared frame KPAGE has been
+   accessed, clearing the accessed bits of all of them.  TLB
+   invalidations are added to BATCH (see userprog/pagedir.h). */
+bool pagecache_test_and_clear_accessed (void *kpage,
+                                        struct pagedir_batch *batch);
+
+/* Unmaps the shared frame KPAGE from every sharer and forgets it.
+   The frame itself is left to the caller. */
+void pagecache_evict (void *kpage);
+
+/* Drops all of T's mappings of cached frames, freeing frames that
+   are no longer mapped anywhere.  Must run before T's page
+   directory is destroyed. */
+void pagecache_drop_process (struct thread *t);
+
+#endif /* vm/pagecache.h */
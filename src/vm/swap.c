@@ -5,9 +5,50 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <stdio.h>
+#include <round.h>
+#include "threads/malloc.h"
+#include "vm/zswap.h"
 
 #include "vm/swap.h"
 
+/* Block device that contains the swap */
+struct block *swap_device;
+
+/* Bitmap of swap slot availablities and corresponding lock */
+static struct bitmap *swap_map;
+static struct lock swap_lock;
+
+/* Slots are handed out in clusters of this many adjacent slots, so
+   that consecutive evictions write consecutive sectors */
+#define SWAP_CLUSTER 16
+
+/* Free slots in each cluster, to find free space without scanning
+   the bitmap */
+static uint16_t *cluster_free;
+static size_t cluster_cnt;
+
+/* Next-fit cursor: the next slot of the cluster being filled, and how
+   many slots of that cluster are still reserved for us */
+static size_t next_slot;
+static size_t cluster_left;
+
+static size_t alloc_slot (size_t hint);
+static void take_slot (size_t);
+static size_t cluster_slots (size_t);
+static size_t find_cluster (bool whole);
+
+/* Represents how many sectors are needed to store a page */
+static size_t SECTORS_PER_PAGE = PGSIZE / BLOCK_SECTOR_SIZE;
+static size_t swap_size_in_page (void);
+
+/* Slots from here up name entries of the compressed RAM tier */
+static size_t zswap_base;
+
+/* Pages swapped in from the RAM tier and from the device */
+static unsigned long long ram_in_cnt;
+static unsigned long long disk_in_cnt;
+
 void
 swap_to_pageit ()
 {
@@ -23,18 +64,42 @@ swap_to_pageit ()
 
   /* initialize all bits to be true */ 
   bitmap_set_all (swap_map, true);
+  lock_init (&swap_lock);
+
+  /* every cluster starts out free */
+  cluster_cnt = DIV_ROUND_UP (bitmap_size (swap_map), SWAP_CLUSTER);
+  cluster_free = malloc (cluster_cnt * sizeof *cluster_free);
+  if (cluster_free == NULL)
+    PANIC ("swap cluster table creation failed");
+  for (size_t c = 0; c < cluster_cnt; c++)
+    cluster_free[c] = cluster_slots (c);
+
+  /* the compressed tier sits in front of the device */
+  zswap_base = bitmap_size (swap_map);
+  zswap_init ();
 }
 
 /* Find an available swap slot and dump in the given page represented by UVA
    If failed, return SWAP_ERROR
-   Otherwise, return the swap slot index */
-/* No inner synchronization, should be used with a sync machanism */
-size_t page_to_swap (const void *uva)
+   Otherwise, return the swap slot index
+   HINT is the slot the caller would like to use, normally the one right
+   after the slot holding the neighbouring page of the same process, so
+   that victims of one process end up in adjacent slots and can be read
+   back together.  Pass SWAP_ERROR for no preference. */
+/* Pages are offered to the compressed RAM tier first, and only go
+   to the device if it refuses them */
+size_t page_to_swap (const void *uva, size_t hint)
 {
-  /* find a swap slot and mark it in use */
-  size_t swap_idx = bitmap_scan_and_flip (swap_map, 0, 1, true);
+  size_t swap_idx = zswap_store (uva);
+
+  if (swap_idx != ZSWAP_ERROR)
+    return zswap_base + swap_idx;
+
+  lock_acquire (&swap_lock);
+  swap_idx = alloc_slot (hint);
+  lock_release (&swap_lock);
     
-  if (swap_idx == BITMAP_ERROR)
+  if (swap_idx == SWAP_ERROR)
     return SWAP_ERROR;
 
   /* write the page of data to the swap slot */
@@ -48,10 +113,19 @@ size_t page_to_swap (const void *uva)
   return swap_idx;
 }
 
-/* Swap a page of data in swap slot SWAP_IDX to a page starting at UVA */
+/* Read the page of data in swap slot SWAP_IDX into the page starting
+   at UVA, leaving the slot allocated */
 void
-swap_to_page(size_t swap_idx, void *uva)
+swap_read_slot (size_t swap_idx, void *uva)
 {
+  if (swap_idx >= zswap_base)
+    {
+      zswap_load (swap_idx - zswap_base, uva);
+      ram_in_cnt++;
+      return;
+    }
+  disk_in_cnt++;
+
   /* swap out the data from swap slot to mem page */
   size_t counter = 0;
   while (counter < SECTORS_PER_PAGE)
@@ -60,14 +134,126 @@ swap_to_page(size_t swap_idx, void *uva)
 		  uva + counter * BLOCK_SECTOR_SIZE);
       counter++;
     }
-  /* free the corresponding swap slot bit in bitmap */
-  bitmap_flip (swap_map, swap_idx);
 }
 
 void swap_clean_slot (size_t swap_idx)
 {
+  if (swap_idx >= zswap_base)
+    {
+      zswap_free (swap_idx - zswap_base);
+      return;
+    }
+
   /* free the corresponding swap slot bit in bitmap */
-  bitmap_flip (swap_map, swap_idx);  
+  lock_acquire (&swap_lock);
+  ASSERT (!bitmap_test (swap_map, swap_idx));
+  bitmap_mark (swap_map, swap_idx);
+  cluster_free[swap_idx / SWAP_CLUSTER]++;
+  lock_release (&swap_lock);
+}
+
+/* Tell whether SWAP_IDX names an entry of the compressed RAM tier
+   rather than a slot of the swap device */
+bool
+swap_slot_in_ram (size_t swap_idx)
+{
+  return swap_idx != SWAP_ERROR && swap_idx >= zswap_base;
+}
+
+/* Print how swap-ins were served, and the RAM tier's statistics */
+void
+swap_print_stats (void)
+{
+  unsigned long long in_cnt = ram_in_cnt + disk_in_cnt;
+
+  printf ("Swap: %llu pages in, %llu from RAM tier (%llu%%), %llu from disk\n",
+          in_cnt, ram_in_cnt, in_cnt > 0 ? ram_in_cnt * 100 / in_cnt : 0,
+          disk_in_cnt);
+  zswap_print_stats ();
+}
+
+/* Allocate a swap slot: HINT if it is free, else the next slot of the
+   cluster being filled, else the first slot of the next wholly free
+   cluster after the cursor, else the first free slot of the next
+   cluster that has one.  Must be called with swap_lock held */
+static size_t
+alloc_slot (size_t hint)
+{
+  size_t c, slot;
+
+  if (hint != SWAP_ERROR && hint < bitmap_size (swap_map)
+      && bitmap_test (swap_map, hint))
+    {
+      take_slot (hint);
+      return hint;
+    }
+
+  if (cluster_left == 0 || !bitmap_test (swap_map, next_slot))
+    {
+      c = find_cluster (true);
+      if (c != SWAP_ERROR)
+        {
+          /* reserve the whole cluster for the evictions to come */
+          next_slot = c * SWAP_CLUSTER;
+          cluster_left = cluster_slots (c);
+        }
+      else
+        {
+          /* swap is fragmented: settle for any free slot */
+          c = find_cluster (false);
+          if (c == SWAP_ERROR)
+            return SWAP_ERROR;
+          slot = bitmap_scan (swap_map, c * SWAP_CLUSTER, 1, true);
+          ASSERT (slot != BITMAP_ERROR);
+          take_slot (slot);
+          next_slot = slot + 1;
+          cluster_left = 0;
+          return slot;
+        }
+    }
+
+  slot = next_slot++;
+  cluster_left--;
+  take_slot (slot);
+  return slot;
+}
+
+/* Mark SLOT in use.  Must be called with swap_lock held */
+static void
+take_slot (size_t slot)
+{
+  bitmap_reset (swap_map, slot);
+  cluster_free[slot / SWAP_CLUSTER]--;
+}
+
+/* Returns how many slots cluster C has; the last one may be short */
+static size_t
+cluster_slots (size_t c)
+{
+  size_t end = (c + 1) * SWAP_CLUSTER;
+
+  if (end > bitmap_size (swap_map))
+    end = bitmap_size (swap_map);
+  return end - c * SWAP_CLUSTER;
+}
+
+/* Returns the first cluster at or after the cursor, wrapping around,
+   that is wholly free if WHOLE, or has any free slot otherwise.
+   Returns SWAP_ERROR if there is none */
+static size_t
+find_cluster (bool whole)
+{
+  size_t start = next_slot / SWAP_CLUSTER;
+  size_t i;
+
+  for (i = 0; i < cluster_cnt; i++)
+    {
+      size_t c = (start + i) % cluster_cnt;
+
+      if (whole ? cluster_free[c] == cluster_slots (c) : cluster_free[c] > 0)
+        return c;
+    }
+  return SWAP_ERROR;
 }
 
 /* Returns how many pages the swap device can contain, which is rounded down */
@@ -1,26 +1,30 @@
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/block.h"
+#include "threads/vaddr.h"
+
 #define SWAP_ERROR SIZE_MAX
 
 /* Block device that contains the swap */
-struct block *swap_device;
-
-/* Bitmap of swap slot availablities and corresponding lock */
-static struct bitmap *swap_map;
-
-/* Represents how many sectors are needed to store a page */
-static size_t SECTORS_PER_PAGE = PGSIZE / BLOCK_SECTOR_SIZE;
-static size_t swap_size_in_page (void);
+extern struct block *swap_device;
 
 /* Swap initialization */
 void swap_to_pageit (void);
 
-/* Swap a frame into a swap slot */
-size_t page_to_swap (const void *);
+/* Swap a frame into a swap slot, preferring the slot given as hint */
+size_t page_to_swap (const void *, size_t);
 
-/* Swap a frame out of a swap slot to mem page */
-void swap_to_page(size_t, void *);
+/* Read a swap slot into a page without releasing the slot */
+void swap_read_slot (size_t, void *);
 
 void swap_clean_slot (size_t);
+
+/* Is the slot an entry of the compressed RAM tier? */
+bool swap_slot_in_ram (size_t);
+
+/* Print swap-in statistics */
+void swap_print_stats (void);
 #endif /* vm/swap.h */
\ No newline at end of file
@@ -0,0 +1,210 @@
+#include <debug.h>
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+#include "vm/vma.h"
+
+static bool vma_less (const struct rb_elem *, const struct rb_elem *, void *);
+static struct vm_area *vma_new (struct thread *, enum vma_type,
+                                void *upage, size_t size, bool writable);
+static bool vma_fits (struct thread *, const void *start, const void *end);
+static void vma_free (struct rb_elem *, void *);
+
+void
+vma_init (struct thread *t)
+{
+  rb_init (&t->vmas, vma_less, NULL);
+}
+
+struct vm_area *
+vma_create_file (struct thread *t, enum vma_type type, struct file *file,
+                 off_t ofs, void *upage, uint32_t read_bytes,
+                 uint32_t zero_bytes, bool writable)
+{
+  struct vm_area *vma;
+  struct file *handle;
+
+  ASSERT (type == VMA_FILE || type == VMA_MMAP);
+  ASSERT (ofs % PGSIZE == 0);
+
+  /* The area keeps its own handle, so pages can still be loaded
+     after the caller closes FILE. */
+  handle = file_reopen (file);
+  if (handle == NULL)
+    return NULL;
+
+  vma = vma_new (t, type, upage, read_bytes + zero_bytes, writable);
+  if (vma == NULL)
+    {
+      file_close (handle);
+      return NULL;
+    }
+  vma->file = handle;
+  vma->ofs = ofs;
+  vma->read_bytes = read_bytes;
+  vma->fault_around = (fault_around_max + 1) / 2;
+  return vma;
+}
+
+struct vm_area *
+vma_create_anon (struct thread *t, enum vma_type type, void *upage,
+                 size_t size)
+{
+  ASSERT (type == VMA_ANON || type == VMA_STACK);
+
+  return vma_new (t, type, upage, size, true);
+}
+
+struct vm_area *
+vma_find (struct thread *t, const void *uaddr)
+{
+  struct vm_area key = { .start = pg_round_down (uaddr) };
+  struct rb_elem *e;
+  struct vm_area *vma;
+
+  e = rb_floor (&t->vmas, &key.elem);
+  if (e == NULL)
+    return NULL;
+
+  vma = rb_entry (e, struct vm_area, elem);
+  return (const uint8_t *) uaddr < vma->end ? vma : NULL;
+}
+
+bool
+vma_extend_stack (struct thread *t, void *upage)
+{
+  struct rb_elem *e = rb_max (&t->vmas);
+  struct vm_area *stack;
+
+  ASSERT (pg_ofs (upage) == 0);
+
+  if (e == NULL)
+    return false;
+  stack = rb_entry (e, struct vm_area, elem);
+  if (stack->type != VMA_STACK)
+    return false;
+  if ((uint8_t *) upage >= stack->start)
+    return true;
+
+  /* Moving the start down keeps the tree in order as long as no
+     other area lies in between. */
+  if (!vma_fits (t, upage, stack->start))
+    return false;
+  stack->start = upage;
+  return true;
+}
+
+bool
+vma_is_file (const struct vm_area *vma)
+{
+  return vma->type == VMA_FILE || vma->type == VMA_MMAP;
+}
+
+off_t
+vma_page_ofs (const struct vm_area *vma, const void *upage)
+{
+  return vma->ofs + ((const uint8_t *) upage - vma->start);
+}
+
+uint32_t
+vma_page_read_bytes (const struct vm_area *vma, const void *upage)
+{
+  uint32_t skip = (const uint8_t *) upage - vma->start;
+
+  if (skip >= vma->read_bytes)
+    return 0;
+  return vma->read_bytes - skip < PGSIZE ? vma->read_bytes - skip : PGSIZE;
+}
+
+bool
+vma_fork (struct thread *parent, struct thread *child)
+{
+  struct rb_elem *e;
+
+  for (e = rb_min (&parent->vmas); e != NULL; e = rb_next (e))
+    {
+      struct vm_area *vma = malloc (sizeof *vma);
+
+      if (vma == NULL)
+        return false;
+      *vma = *rb_entry (e, struct vm_area, elem);
+      if (vma->file != NULL)
+        {
+          vma->file = file_reopen (vma->file);
+          if (vma->file == NULL)
+            {
+              free (vma);
+              return false;
+            }
+        }
+      rb_insert (&child->vmas, &vma->elem);
+    }
+  return true;
+}
+
+void
+vma_destroy_all (struct thread *t)
+{
+  rb_clear (&t->vmas, vma_free);
+}
+
+/* Allocates an area of SIZE bytes at UPAGE and adds it to T's tree,
+   unless it would overlap an existing area. */
+static struct vm_area *
+vma_new (struct thread *t, enum vma_type type, void *upage, size_t size,
+         bool writable)
+{
+  struct vm_area *vma;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (size % PGSIZE == 0 && size > 0);
+
+  if (!vma_fits (t, upage, (uint8_t *) upage + size))
+    return NULL;
+
+  vma = calloc (1, sizeof *vma);
+  if (vma == NULL)
+    return NULL;
+  vma->start = upage;
+  vma->end = (uint8_t *) upage + size;
+  vma->type = type;
+  vma->writable = writable;
+  rb_insert (&t->vmas, &vma->elem);
+  return vma;
+}
+
+/* Returns true if [START, END) overlaps no area of T other than one
+   that starts exactly at END. */
+static bool
+vma_fits (struct thread *t, const void *start, const void *end)
+{
+  struct vm_area key = { .start = (uint8_t *) end - PGSIZE };
+  struct rb_elem *e;
+
+  /* The last area starting before END must end by START. */
+  e = rb_floor (&t->vmas, &key.elem);
+  return e == NULL
+         || rb_entry (e, struct vm_area, elem)->end <= (const uint8_t *) start;
+}
+
+/* Frees the area in tree element E. */
+static void
+vma_free (struct rb_elem *e, void *aux UNUSED)
+{
+  struct vm_area *vma = rb_entry (e, struct vm_area, elem);
+
+  if (vma->file != NULL)
+    file_close (vma->file);
+  free (vma);
+}
+
+static bool
+vma_less (const struct rb_elem *a_, const struct rb_elem *b_,
+          void *aux UNUSED)
+{
+  const struct vm_area *a = rb_entry (a_, struct vm_area, elem);
+  const struct vm_area *b = rb_entry (b_, struct vm_area, elem);
+
+  return a->start < b->start;
+}
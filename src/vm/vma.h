@@ -0,0 +1,89 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+
+#include <rbtree.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/file.h"
+#include "filesys/off_t.h"
+#include "threads/thread.h"
+
+/* Virtual memory areas.
+
+   A process's address space is a set of disjoint page-aligned
+   ranges, each kept in the process's `vmas' tree by start
+   address.  An area says what its pages hold before they are
+   first touched: a range of a file, or zeros.  Setting one up
+   takes constant time however large it is; per-page state is
+   only created when a page has to go to swap. */
+
+enum vma_type
+  {
+    VMA_FILE,                   /* Private file pages, e.g. ELF segments. */
+    VMA_MMAP,                   /* Shared file pages, written back. */
+    VMA_ANON,                   /* Zero-filled pages. */
+    VMA_STACK                   /* Zero-filled pages that grow down. */
+  };
+
+/* An area [start, end) of a process's address space. */
+struct vm_area
+  {
+    uint8_t *start;             /* First page. */
+    uint8_t *end;               /* Page past the last one. */
+    enum vma_type type;         /* What backs the pages. */
+    bool writable;              /* May the process write the pages? */
+
+    /* File-backed areas: READ_BYTES bytes of FILE from OFS are
+       mapped from START, the rest of the area is zeros. */
+    struct file *file;          /* Private handle on the file. */
+    off_t ofs;                  /* File offset of START. */
+    uint32_t read_bytes;        /* File bytes in the area. */
+
+    /* File fault-around state. */
+    int fault_around;           /* Pages currently mapped around a fault. */
+    unsigned ra_hits;           /* Fault-around pages that got used. */
+    unsigned ra_misses;         /* Fault-around pages evicted unused. */
+
+    struct rb_elem elem;        /* Element in the thread's vmas tree. */
+  };
+
+/* Initializes T's empty address space. */
+void vma_init (struct thread *t);
+
+/* Adds an area of T of type VMA_FILE or VMA_MMAP at UPAGE, holding
+   READ_BYTES bytes of FILE from OFS followed by ZERO_BYTES zeros.
+   Returns the area, or a null pointer if it would overlap another
+   area or memory is short. */
+struct vm_area *vma_create_file (struct thread *t, enum vma_type,
+                                 struct file *file, off_t ofs, void *upage,
+                                 uint32_t read_bytes, uint32_t zero_bytes,
+                                 bool writable);
+
+/* Adds a zero-filled area of T of type VMA_ANON or VMA_STACK and
+   SIZE bytes at UPAGE.  Returns the area, or a null pointer. */
+struct vm_area *vma_create_anon (struct thread *t, enum vma_type,
+                                 void *upage, size_t size);
+
+/* Returns the area of T containing UADDR, or a null pointer. */
+struct vm_area *vma_find (struct thread *t, const void *uaddr);
+
+/* Extends T's stack area down to UPAGE.  Returns false if there is
+   no stack area or another area is in the way. */
+bool vma_extend_stack (struct thread *t, void *upage);
+
+/* Returns true if the pages of VMA come from a file. */
+bool vma_is_file (const struct vm_area *vma);
+
+/* File offset and number of file bytes of page UPAGE of VMA. */
+off_t vma_page_ofs (const struct vm_area *vma, const void *upage);
+uint32_t vma_page_read_bytes (const struct vm_area *vma, const void *upage);
+
+/* Gives CHILD a copy of each area of PARENT, with its own handle on
+   the file of a file-backed area.  Returns false if memory is short. */
+bool vma_fork (struct thread *parent, struct thread *child);
+
+/* Removes every area of T. */
+void vma_destroy_all (struct thread *t);
+
+#endif /* vm/vma.h */
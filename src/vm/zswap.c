@@ -0,0 +1,206 @@
+#include <bitmap.h>
+#include <debug.h>
+#include <lz.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+#include "vm/zswap.h"
+
+/* Compressed pages are stored in runs of chunks of this size. */
+#define ZSWAP_CHUNK 64
+
+/* Pages that do not compress to this size or less go to disk. */
+#define ZSWAP_MAX_SIZE (PGSIZE * 3 / 4)
+
+/* A stored page. */
+struct zswap_entry
+  {
+    bool same_filled;           /* Every word of the page is FILL? */
+    uint32_t fill;              /* Repeated word of a same-filled page. */
+    uint32_t chunk;             /* First pool chunk of compressed data. */
+    uint16_t size;              /* Bytes of compressed data. */
+  };
+
+size_t zswap_pool_pages = ZSWAP_DEFAULT_PAGES;
+
+/* Pool of compressed data and its chunk allocation map. */
+static uint8_t *pool;
+static struct bitmap *chunk_map;
+
+/* Entries, and which of them are in use. */
+static struct zswap_entry *entries;
+static struct bitmap *entry_map;
+
+/* Compressor scratch space, kept off the kernel stack. */
+static uint8_t scratch[ZSWAP_MAX_SIZE];
+static uint16_t htab[LZ_HTAB_SIZE];
+
+/* Protects everything above. */
+static struct lock zswap_lock;
+
+/* Statistics. */
+static unsigned long long stored_cnt;    /* Pages stored. */
+static unsigned long long same_cnt;      /* ...of which same-filled. */
+static unsigned long long reject_cnt;    /* Refused: compressed badly. */
+static unsigned long long full_cnt;      /* Refused: pool full. */
+static unsigned long long load_cnt;      /* Pages loaded back. */
+static unsigned long long orig_bytes;    /* Bytes of compressed pages in. */
+static unsigned long long comp_bytes;    /* Bytes of compressed pages out. */
+
+static bool page_same_filled (const void *, uint32_t *);
+
+void
+zswap_init (void)
+{
+  size_t chunk_cnt, entry_cnt;
+
+  lock_init (&zswap_lock);
+
+  /* Take what we can get, down to nothing. */
+  while (zswap_pool_pages > 0
+         && (pool = palloc_get_multiple (PAL_USER, zswap_pool_pages)) == NULL)
+    zswap_pool_pages /= 2;
+  if (pool == NULL)
+    return;
+
+  chunk_cnt = zswap_pool_pages * PGSIZE / ZSWAP_CHUNK;
+  entry_cnt = chunk_cnt;
+  chunk_map = bitmap_create (chunk_cnt);
+  entry_map = bitmap_create (entry_cnt);
+  entries = malloc (entry_cnt * sizeof *entries);
+  if (chunk_map == NULL || entry_map == NULL || entries == NULL)
+    PANIC ("zswap: out of memory for a %zu-page pool", zswap_pool_pages);
+}
+
+size_t
+zswap_store (const void *kpage)
+{
+  struct zswap_entry *e;
+  size_t idx, size, chunk;
+  uint32_t fill;
+
+  if (pool == NULL)
+    return ZSWAP_ERROR;
+
+  lock_acquire (&zswap_lock);
+  idx = bitmap_scan_and_flip (entry_map, 0, 1, false);
+  if (idx == BITMAP_ERROR)
+    {
+      full_cnt++;
+      goto refuse;
+    }
+  e = &entries[idx];
+
+  if (page_same_filled (kpage, &fill))
+    {
+      /* Nothing to compress: remember the word. */
+      e->same_filled = true;
+      e->fill = fill;
+      same_cnt++;
+      stored_cnt++;
+      lock_release (&zswap_lock);
+      return idx;
+    }
+
+  size = lz_compress (kpage, PGSIZE, scratch, sizeof scratch, htab);
+  if (size == 0)
+    {
+      reject_cnt++;
+      goto release_entry;
+    }
+
+  chunk = bitmap_scan_and_flip (chunk_map, 0, DIV_ROUND_UP (size, ZSWAP_CHUNK),
+                                false);
+  if (chunk == BITMAP_ERROR)
+    {
+      full_cnt++;
+      goto release_entry;
+    }
+
+  memcpy (pool + chunk * ZSWAP_CHUNK, scratch, size);
+  e->same_filled = false;
+  e->chunk = chunk;
+  e->size = size;
+  stored_cnt++;
+  orig_bytes += PGSIZE;
+  comp_bytes += size;
+  lock_release (&zswap_lock);
+  return idx;
+
+ release_entry:
+  bitmap_reset (entry_map, idx);
+ refuse:
+  lock_release (&zswap_lock);
+  return ZSWAP_ERROR;
+}
+
+void
+zswap_load (size_t idx, void *kpage)
+{
+  struct zswap_entry *e;
+
+  lock_acquire (&zswap_lock);
+  ASSERT (bitmap_test (entry_map, idx));
+  e = &entries[idx];
+  if (e->same_filled)
+    {
+      uint32_t *word = kpage;
+      size_t i;
+
+      for (i = 0; i < PGSIZE / sizeof *word; i++)
+        word[i] = e->fill;
+    }
+  else if (lz_decompress (pool + e->chunk * ZSWAP_CHUNK, e->size,
+                          kpage, PGSIZE) != PGSIZE)
+    PANIC ("zswap: entry %zu is corrupt", idx);
+  load_cnt++;
+  lock_release (&zswap_lock);
+}
+
+void
+zswap_free (size_t idx)
+{
+  struct zswap_entry *e;
+
+  lock_acquire (&zswap_lock);
+  ASSERT (bitmap_test (entry_map, idx));
+  e = &entries[idx];
+  if (!e->same_filled)
+    bitmap_set_multiple (chunk_map, e->chunk,
+                         DIV_ROUND_UP (e->size, ZSWAP_CHUNK), false);
+  bitmap_reset (entry_map, idx);
+  lock_release (&zswap_lock);
+}
+
+void
+zswap_print_stats (void)
+{
+  if (pool == NULL)
+    return;
+  printf ("Zswap: %llu pages stored (%llu same-filled), %llu loaded, "
+          "%llu incompressible, %llu refused when full\n",
+          stored_cnt, same_cnt, load_cnt, reject_cnt, full_cnt);
+  if (comp_bytes > 0)
+    printf ("Zswap: compressed %llu bytes to %llu (%llu%%)\n",
+            orig_bytes, comp_bytes, comp_bytes * 100 / orig_bytes);
+}
+
+/* Returns true if every 32-bit word of the page at KPAGE is the
+   same, storing that word in *FILL. */
+static bool
+page_same_filled (const void *kpage, uint32_t *fill)
+{
+  const uint32_t *word = kpage;
+  size_t i;
+
+  for (i = 1; i < PGSIZE / sizeof *word; i++)
+    if (word[i] != word[0])
+      return false;
+  *fill = word[0];
+  return true;
+}
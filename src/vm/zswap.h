@@ -0,0 +1,38 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compressed in-memory swap tier.
+
+   Pages on their way to the swap device are first offered here.
+   Pages whose words are all equal (zero pages above all) are kept
+   as that single word; others are compressed into a pool of
+   pages carved from the user pool at boot.  Pages that compress
+   badly, or that do not fit in the pool, go to the swap device. */
+
+#define ZSWAP_ERROR SIZE_MAX
+#define ZSWAP_DEFAULT_PAGES 32  /* Default pool size, in pages. */
+
+/* Pool size requested with -zswap, in pages; 0 disables the tier. */
+extern size_t zswap_pool_pages;
+
+/* Sets up the pool.  Must run before any user process. */
+void zswap_init (void);
+
+/* Stores the page at KPAGE.  Returns its entry, or ZSWAP_ERROR if
+   the page should go to the swap device instead. */
+size_t zswap_store (const void *kpage);
+
+/* Copies entry IDX back into the page at KPAGE. */
+void zswap_load (size_t idx, void *kpage);
+
+/* Frees entry IDX. */
+void zswap_free (size_t idx);
+
+/* Prints compression statistics. */
+void zswap_print_stats (void);
+
+#endif /* vm/zswap.h */